@@ -0,0 +1,191 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef BGZF_WRITER_H
+#define BGZF_WRITER_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class bgzf_writer
+// ----------------------------------------------------------------------------
+// Writes a BGZF file (a series of gzip members of at most 64 KiB, as used by
+// BAM). Unlike seqan's BGZF stream it tells the compressed offset at which a
+// record starts: start_record() closes the current block, so a reader can seek
+// to the offset and inflate from there with any gzip library.
+class bgzf_writer
+{
+public:
+    // as in htslib, leaves room for incompressible input
+    static const uint32_t   MAX_BLOCK_INPUT     = 0xff00;
+    static const uint32_t   MAX_BLOCK_SIZE      = 0x10000;
+    static const uint32_t   BLOCK_HEADER_LENGTH = 18;
+    static const uint32_t   BLOCK_FOOTER_LENGTH = 8;
+
+    explicit bgzf_writer(std::string const & file_path, int level = Z_DEFAULT_COMPRESSION) :
+                         _stream(file_path, std::ios::binary),
+                         _level(level)
+    {
+        _input.reserve(MAX_BLOCK_INPUT);
+        _block.resize(MAX_BLOCK_SIZE);
+    }
+
+    ~bgzf_writer()
+    {
+        close();
+    }
+
+    bgzf_writer(bgzf_writer const &) = delete;
+    bgzf_writer & operator=(bgzf_writer const &) = delete;
+
+    inline bool is_open() const
+    {
+        return _stream.is_open();
+    }
+
+    // no block failed to compress or to be written
+    inline bool good() const
+    {
+        return !_failed && _stream.good();
+    }
+
+    // the compressed offset of the data written next. starts a new block.
+    inline uint64_t start_record()
+    {
+        flush();
+        return _offset;
+    }
+
+    inline void write(char const * data, size_t size)
+    {
+        while (size > 0)
+        {
+            size_t n = std::min<size_t>(size, MAX_BLOCK_INPUT - _input.size());
+            _input.insert(_input.end(), data, data + n);
+            data += n;
+            size -= n;
+            if (_input.size() == MAX_BLOCK_INPUT)
+                flush();
+        }
+    }
+
+    // little-endian, independent of the host
+    inline void write_uint32(uint32_t value)
+    {
+        char bytes[4] = {char(value), char(value >> 8), char(value >> 16), char(value >> 24)};
+        write(bytes, 4);
+    }
+
+    inline void flush()
+    {
+        if (!_input.empty())
+            _write_block();
+    }
+
+    // flush and append the empty end-of-file block
+    inline void close()
+    {
+        if (!_stream.is_open())
+            return;
+        flush();
+        _write_block();
+        _stream.close();
+    }
+
+private:
+    std::ofstream       _stream;
+    std::vector<char>   _input;
+    std::vector<char>   _block;
+    uint64_t            _offset = 0;
+    int                 _level;
+    bool                _failed = false;
+
+    // deflate the input into the block, false if it does not fit
+    inline bool _deflate(int level, uint32_t & compressed_size)
+    {
+        z_stream zs = {};
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        zs.next_in = reinterpret_cast<Bytef *>(_input.data());
+        zs.avail_in = _input.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&_block[BLOCK_HEADER_LENGTH]);
+        zs.avail_out = MAX_BLOCK_SIZE - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
+        int status = deflate(&zs, Z_FINISH);
+        compressed_size = zs.total_out;
+        deflateEnd(&zs);
+        return status == Z_STREAM_END;
+    }
+
+    inline void _write_block()
+    {
+        // incompressible input is stored, which always fits (see MAX_BLOCK_INPUT)
+        uint32_t compressed_size = 0;
+        if (!_deflate(_level, compressed_size) && !_deflate(Z_NO_COMPRESSION, compressed_size))
+        {
+            if (!_failed)
+                std::cerr << "[ERROR!] Unable to compress a BGZF block.\n";
+            _failed = true;
+            _input.clear();
+            return;
+        }
+        uint32_t block_size = BLOCK_HEADER_LENGTH + compressed_size + BLOCK_FOOTER_LENGTH;
+
+        // gzip header with the BC extra field holding the block size - 1
+        char const header[BLOCK_HEADER_LENGTH] = {31, char(139), 8, 4, 0, 0, 0, 0, 0, char(255), 6, 0, 'B', 'C', 2, 0,
+                                                  char(block_size - 1), char((block_size - 1) >> 8)};
+        std::copy(header, header + BLOCK_HEADER_LENGTH, _block.begin());
+        uint32_t crc = crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const *>(_input.data()), _input.size());
+        uint32_t input_size = _input.size();
+        char * footer = &_block[block_size - BLOCK_FOOTER_LENGTH];
+        for (uint32_t i=0; i < 4; ++i)
+        {
+            footer[i] = char(crc >> (8 * i));
+            footer[4 + i] = char(input_size >> (8 * i));
+        }
+        _stream.write(_block.data(), block_size);
+        _offset += block_size;
+        _input.clear();
+    }
+};
+
+#endif /* BGZF_WRITER_H */
@@ -0,0 +1,231 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef BUFFERED_WRITER_H
+#define BUFFERED_WRITER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Function format_uint()
+// ----------------------------------------------------------------------------
+// writes the decimal digits of value right-aligned before end (20 characters
+// are enough for any value). returns the first digit.
+inline char * format_uint(char * end, uint64_t value)
+{
+    char * first = end;
+    do
+    {
+        *--first = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    return first;
+}
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class buffered_writer
+// ----------------------------------------------------------------------------
+// Writes text reports through a large buffer. Integers are formatted by hand
+// and floats by snprintf("%g"), which gives the same text as the default
+// formatting of std::ostream without going through its locale facets.
+class buffered_writer
+{
+public:
+    explicit buffered_writer(std::string const & file_path, size_t buffer_size = 1 << 20) :
+                             _stream(file_path, std::ios::binary),
+                             _buffer(buffer_size)
+    {}
+
+    ~buffered_writer()
+    {
+        close();
+    }
+
+    buffered_writer(buffered_writer const &) = delete;
+    buffered_writer & operator=(buffered_writer const &) = delete;
+
+    inline bool is_open() const
+    {
+        return _stream.is_open();
+    }
+
+    // nothing failed to be written (or closed)
+    inline bool good() const
+    {
+        return _stream.good();
+    }
+
+    inline void write(char const * data, size_t size)
+    {
+        if (_pos + size > _buffer.size())
+        {
+            flush();
+            // larger than the whole buffer. write it directly.
+            if (size > _buffer.size())
+            {
+                _stream.write(data, size);
+                return;
+            }
+        }
+        std::copy(data, data + size, _buffer.data() + _pos);
+        _pos += size;
+    }
+
+    inline void put(char c)
+    {
+        if (_pos == _buffer.size())
+            flush();
+        _buffer[_pos++] = c;
+    }
+
+    inline void write_uint(uint64_t value)
+    {
+        char digits[20];
+        char * end = digits + sizeof(digits);
+        char * first = format_uint(end, value);
+        write(first, end - first);
+    }
+
+    inline void write_int(int64_t value)
+    {
+        if (value < 0)
+        {
+            put('-');
+            write_uint(uint64_t(0) - uint64_t(value));
+        }
+        else
+        {
+            write_uint(value);
+        }
+    }
+
+    inline void write_float(double value)
+    {
+        char text[32];
+        int size = std::snprintf(text, sizeof(text), "%g", value);
+        write(text, size);
+    }
+
+    // all digits of value: the shorter of %.15g and %.17g that reads back as
+    // value. integers below 1e15 are written without an exponent.
+    inline void write_double(double value)
+    {
+        char text[32];
+        int size = std::snprintf(text, sizeof(text), "%.15g", value);
+        if (std::strtod(text, nullptr) != value)
+            size = std::snprintf(text, sizeof(text), "%.17g", value);
+        write(text, size);
+    }
+
+    inline void flush()
+    {
+        if (_pos > 0)
+            _stream.write(_buffer.data(), _pos);
+        _pos = 0;
+    }
+
+    inline void close()
+    {
+        if (!_stream.is_open())
+            return;
+        flush();
+        _stream.close();
+    }
+
+private:
+    std::ofstream       _stream;
+    std::vector<char>   _buffer;
+    size_t              _pos = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Function operator<<()
+// ----------------------------------------------------------------------------
+
+inline buffered_writer & operator<<(buffered_writer & writer, char c)
+{
+    writer.put(c);
+    return writer;
+}
+
+inline buffered_writer & operator<<(buffered_writer & writer, char const * text)
+{
+    writer.write(text, std::strlen(text));
+    return writer;
+}
+
+inline buffered_writer & operator<<(buffered_writer & writer, std::string const & text)
+{
+    writer.write(text.data(), text.size());
+    return writer;
+}
+
+template <typename TValue>
+inline typename std::enable_if<std::is_integral<TValue>::value && std::is_unsigned<TValue>::value, buffered_writer &>::type
+operator<<(buffered_writer & writer, TValue value)
+{
+    writer.write_uint(value);
+    return writer;
+}
+
+template <typename TValue>
+inline typename std::enable_if<std::is_integral<TValue>::value && std::is_signed<TValue>::value, buffered_writer &>::type
+operator<<(buffered_writer & writer, TValue value)
+{
+    writer.write_int(value);
+    return writer;
+}
+
+inline buffered_writer & operator<<(buffered_writer & writer, double value)
+{
+    writer.write_float(value);
+    return writer;
+}
+
+#endif /* BUFFERED_WRITER_H */
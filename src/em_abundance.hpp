@@ -0,0 +1,165 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef EM_ABUNDANCE_H
+#define EM_ABUNDANCE_H
+
+using namespace seqan;
+
+// the number of partial sums of an E-step
+int64_t const EM_CHUNKS_COUNT = 16;
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function em_abundance()
+// --------------------------------------------------------------------------
+// Expectation-maximization of reference abundances. References are addressed
+// by their position in lengths and uniq_counts; the targets of classes refer
+// to the same positions. Each iteration redistributes the reads of every
+// class among its targets in proportion to their abundance per base.
+// On return counts holds the (fractional) number of reads of every reference.
+// Returns the number of iterations it took to converge.
+inline uint32_t em_abundance(std::vector<double> & counts,
+                             std::vector<read_class> const & classes,
+                             std::vector<double> const & uniq_counts,
+                             std::vector<double> const & lengths,
+                             double const tolerance,
+                             uint32_t const max_iterations)
+{
+    size_t refs_count = lengths.size();
+    int64_t classes_count = classes.size();
+    double total_count = std::accumulate(uniq_counts.begin(), uniq_counts.end(), 0.0);
+
+    // start with the ambiguous reads split evenly among their targets
+    counts = uniq_counts;
+    for (auto const & rc : classes)
+    {
+        total_count += rc.count;
+        for (uint32_t target : rc.targets)
+            counts[target] += double(rc.count) / rc.targets.size();
+    }
+    if (total_count == 0 || classes.empty())
+        return 0;
+
+    std::vector<double> abundance(refs_count);
+    std::vector<double> per_base(refs_count);
+    for (size_t i = 0; i < refs_count; ++i)
+        abundance[i] = counts[i] / total_count;
+
+    // one accumulator per chunk of classes, merged in chunk order. the chunks
+    // do not depend on the number of threads, neither do the sums.
+    int64_t const chunks_count = std::min<int64_t>(EM_CHUNKS_COUNT, classes_count);
+    std::vector<std::vector<double> > partial_counts(chunks_count, std::vector<double>(refs_count));
+
+    uint32_t iteration = 0;
+    while (iteration < max_iterations)
+    {
+        ++iteration;
+        for (size_t i = 0; i < refs_count; ++i)
+            per_base[i] = lengths[i] > 0 ? abundance[i] / lengths[i] : 0.0;
+
+        // E-step: expected share of each target in the reads of a class
+        parallel_for_tasks(chunks_count, [&](int64_t chunk)
+        {
+            std::vector<double> & chunk_counts = partial_counts[chunk];
+            std::fill(chunk_counts.begin(), chunk_counts.end(), 0.0);
+            int64_t chunk_end = classes_count * (chunk + 1) / chunks_count;
+            for (int64_t c = classes_count * chunk / chunks_count; c < chunk_end; ++c)
+            {
+                read_class const & rc = classes[c];
+                double denominator = 0.0;
+                for (uint32_t target : rc.targets)
+                    denominator += per_base[target];
+                if (denominator > 0)
+                {
+                    double weight = rc.count / denominator;
+                    for (uint32_t target : rc.targets)
+                        chunk_counts[target] += per_base[target] * weight;
+                }
+                else
+                {
+                    double weight = double(rc.count) / rc.targets.size();
+                    for (uint32_t target : rc.targets)
+                        chunk_counts[target] += weight;
+                }
+            }
+        });
+
+        // M-step: new abundances from the unique and the expected reads
+        counts = uniq_counts;
+        for (auto const & chunk_counts : partial_counts)
+            for (size_t i = 0; i < refs_count; ++i)
+                counts[i] += chunk_counts[i];
+
+        double max_change = 0.0;
+        for (size_t i = 0; i < refs_count; ++i)
+        {
+            double new_abundance = counts[i] / total_count;
+            max_change = std::max(max_change, std::abs(new_abundance - abundance[i]));
+            abundance[i] = new_abundance;
+        }
+        if (max_change < tolerance)
+            break;
+    }
+    return iteration;
+}
+
+// --------------------------------------------------------------------------
+// Function apportion_counts()
+// --------------------------------------------------------------------------
+// Round the fractional counts to integers that add up to total by the largest
+// remainder method. Ties go to the lower position.
+inline void apportion_counts(std::vector<uint32_t> & rounded,
+                             std::vector<double> const & counts,
+                             uint64_t const total)
+{
+    rounded.resize(counts.size());
+    uint64_t rounded_sum = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        rounded[i] = uint32_t(std::floor(counts[i]));
+        rounded_sum += rounded[i];
+    }
+    std::vector<size_t> order(counts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return counts[a] - rounded[a] > counts[b] - rounded[b]; });
+    for (size_t k = 0; k < order.size() && rounded_sum < total; ++k, ++rounded_sum)
+        ++rounded[order[k]];
+}
+
+#endif /* EM_ABUNDANCE_H */
@@ -6,12 +6,13 @@ using namespace seqan;
 #include <fstream>
 #include <map>
 #include <utility>
+#include <sys/stat.h>
 
 #ifdef _WIN32
     #include <io.h>
     #define access    _access_s
 
-    std::vector<std::string> get_bam_files_in_directory(std::string directory)
+    std::vector<std::string> get_files_in_directory(std::string directory, std::vector<std::string> const & extensions)
     {
         std::vector<std::string>  input_paths;
         HANDLE dir;
@@ -34,9 +35,9 @@ using namespace seqan;
             if (is_directory)
                 continue;
 
-            if(full_file_name.find(".sam") == full_file_name.find_last_of(".") ||
-                full_file_name.find(".bam")  == full_file_name.find_last_of(".") )
-             input_paths.push_back(full_file_name);
+            for (auto const & extension : extensions)
+                if(full_file_name.find(extension) == full_file_name.find_last_of("."))
+                    input_paths.push_back(full_file_name);
         } while (FindNextFile(dir, &file_data));
 
         FindClose(dir);
@@ -45,7 +46,7 @@ using namespace seqan;
 
 #else
     #include <unistd.h>
-    std::vector<std::string> get_bam_files_in_directory(std::string directory)
+    std::vector<std::string> get_files_in_directory(std::string directory, std::vector<std::string> const & extensions)
     {
         std::vector<std::string>  input_paths;
         DIR *dir;
@@ -53,6 +54,8 @@ using namespace seqan;
         struct stat st;
 
         dir = opendir(directory.c_str());
+        if (dir == NULL)
+            return input_paths; /* No such directory */
         while ((ent = readdir(dir)) != NULL)
         {
             const std::string file_name = ent->d_name;
@@ -70,13 +73,13 @@ using namespace seqan;
                 continue;
 
 
-            if(full_file_name.find(".sam") == full_file_name.find_last_of(".") ||
-               full_file_name.find(".bam")  == full_file_name.find_last_of(".") )
-                input_paths.push_back(full_file_name);
+            for (auto const & extension : extensions)
+                if(full_file_name.find(extension) == full_file_name.find_last_of("."))
+                    input_paths.push_back(full_file_name);
         }
         closedir(dir);
         return input_paths;
-    } // get_bam_files_in_directory
+    } // get_files_in_directory
 
 #endif
 
@@ -85,6 +88,12 @@ bool is_file(const char* path)
     return access(path, 0 ) == 0;
 }
 
+bool is_directory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
 std::string get_file_name (const std::string& str)
 {
     std::size_t found = str.find_last_of("/\\");
@@ -113,6 +122,11 @@ std::string get_tsv_file_name(const std::string & output_prefix, const std::stri
         {
             file_name.replace((file_name.find_last_of(".")), 4, "");
         }
+        else if (file_name.find(".slst") != std::string::npos &&
+                 file_name.find(".slst") == file_name.find_last_of("."))
+        {
+            file_name.replace((file_name.find_last_of(".")), 5, "");
+        }
     }
     return dir_name + "/" + file_name;
 }
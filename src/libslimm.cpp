@@ -0,0 +1,245 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+
+#include <seqan/basic.h>
+#include <seqan/file.h>
+#include <seqan/sequence.h>
+#include <seqan/bam_io.h>
+#include <seqan/parallel.h>
+
+#include <string>
+#include <thread>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+#include "timer.hpp"
+#include "buffered_writer.hpp"
+#include "bgzf_writer.hpp"
+#include "misc.hpp"
+#include "file_helper.hpp"
+#include "reference_contig.hpp"
+#include "read_stat.hpp"
+#include "partial_state.hpp"
+#include "shared_database.hpp"
+#include "em_abundance.hpp"
+#include "libslimm.hpp"
+
+#include "slimm.hpp"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class slimm_profiler::impl
+// ----------------------------------------------------------------------------
+struct slimm_profiler::impl
+{
+    arg_options                         options;
+    // the database the samples borrow, shared with the profilers made from this one
+    std::shared_ptr<db_image const>     db;
+    std::unique_ptr<slimm>              sample;
+    // why the profiler or the last sample failed
+    std::string                         error;
+
+    // load the database, an error is kept instead of thrown
+    impl(arg_options const & op) : options(op)
+    {
+        std::shared_ptr<db_image> image(new db_image());
+        try
+        {
+            load_db_image(*image, options);
+            db = image;
+        }
+        catch (std::exception const & e)
+        {
+            error = e.what();
+        }
+    }
+
+    // borrow the database of another profiler
+    impl(arg_options const & op, impl const & other) : options(op), db(other.db), error(other.error) {}
+
+    // the key of a read in slimm::reads, mates are told apart like in BAM files
+    inline void add_hit(std::string & key, uint32_t ref_id, uint32_t pos, uint16_t flags)
+    {
+        if (!sample || (flags & BAM_FLAG_UNMAPPED) || ref_id >= sample->references.size())
+            return;
+        if (flags & BAM_FLAG_FIRST)
+            key += ".1";
+        else if (flags & BAM_FLAG_LAST)
+            key += ".2";
+        sample->add_hit(key, ref_id, pos);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class slimm_profiler
+// ----------------------------------------------------------------------------
+// the slimm options of the profiler options
+inline arg_options to_arg_options(slimm_profiler_options const & options)
+{
+    arg_options op;
+    op.database_path        = options.database_path;
+    op.shared_memory_name   = options.shared_memory_name;
+    op.ranks                = options.ranks;
+    op.cov_cut_off          = options.cov_cut_off;
+    op.abundance_cut_off    = options.abundance_cut_off;
+    op.bin_width            = options.bin_width;
+    op.min_reads            = options.min_reads;
+    op.em                   = options.em;
+    op.bootstrap_count      = options.bootstrap_count;
+    return op;
+}
+
+slimm_profiler::slimm_profiler(slimm_profiler_options const & options) :
+    _impl(new impl(to_arg_options(options)))
+{}
+
+slimm_profiler::slimm_profiler(slimm_profiler_options const & options, slimm_profiler const & db_owner) :
+    _impl(new impl(to_arg_options(options), *db_owner._impl))
+{}
+
+slimm_profiler::~slimm_profiler() {}
+
+bool slimm_profiler::ok() const
+{
+    return _impl->db != nullptr;
+}
+
+std::string const & slimm_profiler::error() const
+{
+    return _impl->error;
+}
+
+bool slimm_profiler::begin_sample(std::vector<std::string> const & contig_names,
+                                  std::vector<uint32_t> const & contig_lengths,
+                                  uint32_t avg_read_length)
+{
+    _impl->sample.reset();
+    if (!ok())
+        return false;
+    std::ostringstream error;
+    if (contig_names.size() != contig_lengths.size())
+        error << contig_names.size() << " contig names but " << contig_lengths.size() << " lengths given.";
+    arg_options op = _impl->options;
+    if (op.bin_width == 0)
+        op.bin_width = avg_read_length;
+    if (op.bin_width == 0)
+        error << "Neither a bin width nor the average read length is given.";
+    _impl->error = error.str();
+    if (!_impl->error.empty())
+        return false;
+
+    try
+    {
+        _impl->sample.reset(new slimm(op, *_impl->db, std::string()));
+        slimm & sample = *_impl->sample;
+        sample.quiet = true;
+        sample.avg_read_length = avg_read_length;
+
+        StringSet<CharString> names;
+        for (auto const & name : contig_names)
+            appendValue(names, CharString(name.c_str()));
+        sample.init_references(names, contig_lengths);
+    }
+    catch (std::exception const & e)
+    {
+        _impl->error = e.what();
+        _impl->sample.reset();
+        return false;
+    }
+    return true;
+}
+
+void slimm_profiler::add_hit(std::string const & qname, uint32_t ref_id, uint32_t pos, uint16_t flags)
+{
+    std::string key = qname;
+    _impl->add_hit(key, ref_id, pos, flags);
+}
+
+void slimm_profiler::add_hits(slimm_hit const * hits, size_t count)
+{
+    std::string key;
+    for (size_t i=0; i < count; ++i)
+    {
+        // the raw bytes of the hash fit into the small string buffer
+        key.assign(reinterpret_cast<char const *>(&hits[i].qname_hash), sizeof(hits[i].qname_hash));
+        _impl->add_hit(key, hits[i].ref_id, hits[i].pos, hits[i].flags);
+    }
+}
+
+void slimm_profiler::add_hits(std::function<bool(slimm_hit &)> const & next)
+{
+    slimm_hit hit;
+    while (next(hit))
+        add_hits(&hit, 1);
+}
+
+std::vector<slimm_profile_row> slimm_profiler::end_sample()
+{
+    std::vector<slimm_profile_row> rows;
+    if (!_impl->sample)
+        return rows;
+    slimm & sample = *_impl->sample;
+    try
+    {
+        sample.finish_ingest();
+        if (sample.hits_count > 0)
+        {
+            std::ostream no_log(nullptr);
+            Timer<> stop_watch;
+            sample.compute_profile(no_log, stop_watch);
+
+            std::vector<slimm_profile_row> rank_rows;
+            for (auto rank : sample.considered_ranks)
+            {
+                sample.get_profile_rows(rank, rank_rows);
+                rows.insert(rows.end(), rank_rows.begin(), rank_rows.end());
+            }
+        }
+    }
+    catch (std::exception const & e)
+    {
+        _impl->error = e.what();
+        rows.clear();
+    }
+    _impl->sample.reset();
+    return rows;
+}
@@ -0,0 +1,146 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef LIBSLIMM_H
+#define LIBSLIMM_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class slimm_profile_row
+// ----------------------------------------------------------------------------
+// a row of a taxonomic profile as written to PREFIX_profile.tsv
+struct slimm_profile_row
+{
+    std::string         rank;
+    uint32_t            taxa_id             = 0;
+    // the reads under taxa_id not resolved to the rank (written as taxa_id*)
+    bool                unclassified        = false;
+    std::string         linage;
+    double              abundance           = 0.0;
+    uint32_t            read_count          = 0;
+    // 95% confidence interval, only set with bootstrap replicates
+    double              abundance_ci_low    = 0.0;
+    double              abundance_ci_high   = 0.0;
+};
+
+// ----------------------------------------------------------------------------
+// Class slimm_hit
+// ----------------------------------------------------------------------------
+// an alignment of a read identified by a hash of its name
+struct slimm_hit
+{
+    uint64_t            qname_hash;
+    // index of the reference in the contig names given to begin_sample()
+    uint32_t            ref_id;
+    // 0-based leftmost position
+    uint32_t            pos;
+    // SAM flags. unmapped hits are skipped, first/last tell the mates apart.
+    uint16_t            flags;
+};
+
+// ----------------------------------------------------------------------------
+// Class slimm_profiler_options
+// ----------------------------------------------------------------------------
+// the profiling options of the slimm command line with the same defaults
+struct slimm_profiler_options
+{
+    std::string                 database_path;
+    // attach to a database published by slimm_shm instead of loading one
+    std::string                 shared_memory_name;
+    std::vector<std::string>    ranks               = {"species"};
+    float                       cov_cut_off         = 0.95;
+    float                       abundance_cut_off   = 0.01;
+    // 0 uses the average read length
+    uint32_t                    bin_width           = 0;
+    uint32_t                    min_reads           = 0;
+    bool                        em                  = false;
+    uint32_t                    bootstrap_count     = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Class slimm_profiler
+// ----------------------------------------------------------------------------
+// Profiles samples whose alignments are handed over in memory, e.g. by an
+// aligner while it maps the reads. The database is loaded once. A sample is
+// started with begin_sample(), fed with hits and profiled by end_sample().
+// Hits of a sample are keyed either by read name or by name hash, not both.
+// A profiler is not thread-safe; use one per concurrent sample. Profilers
+// made from another one share its database. Nothing exits the process: a
+// profiler whose database could not be loaded is not ok(), a failed sample
+// returns false or no rows, and error() tells why.
+class slimm_profiler
+{
+public:
+    explicit slimm_profiler(slimm_profiler_options const & options);
+    // borrows the database of db_owner, the database options are not used
+    slimm_profiler(slimm_profiler_options const & options, slimm_profiler const & db_owner);
+    ~slimm_profiler();
+
+    // the database is loaded
+    bool ok() const;
+    std::string const & error() const;
+
+    slimm_profiler(slimm_profiler const &) = delete;
+    slimm_profiler & operator=(slimm_profiler const &) = delete;
+
+    // start a sample mapped against the references of a SAM/BAM header.
+    // avg_read_length places the hits in bins and is the default bin width.
+    bool begin_sample(std::vector<std::string> const & contig_names,
+                      std::vector<uint32_t> const & contig_lengths,
+                      uint32_t avg_read_length);
+
+    void add_hit(std::string const & qname, uint32_t ref_id, uint32_t pos, uint16_t flags);
+    void add_hits(slimm_hit const * hits, size_t count);
+    // pulls hits until next() returns false
+    void add_hits(std::function<bool(slimm_hit &)> const & next);
+
+    // filter the sample, assign its reads and return the profile rows of all
+    // ranks of the options. the sample is dropped afterwards.
+    std::vector<slimm_profile_row> end_sample();
+
+private:
+    struct impl;
+    std::unique_ptr<impl> _impl;
+};
+
+#endif /* LIBSLIMM_H */
@@ -0,0 +1,184 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace seqan;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class async_line_reader
+// ----------------------------------------------------------------------------
+// Reads a plain, gzip, bgzf or bzip2 text file line by line. Decompression
+// is done by seqan's VirtualStream (bgzf blocks are inflated in parallel)
+// on a separate producer thread which hands over newline-aligned chunks
+// through a bounded queue. Parsing thus overlaps with decompression.
+class async_line_reader
+{
+public:
+    async_line_reader(std::string const & file_path,
+                      size_t chunk_size = 1 << 22,
+                      size_t max_queued_chunks = 4) :
+                      _chunk_size(chunk_size),
+                      _max_queued_chunks(max_queued_chunks)
+    {
+        _is_open = open(_stream, toCString(file_path));
+        if (_is_open)
+            _producer = std::thread(&async_line_reader::_produce, this);
+    }
+
+    ~async_line_reader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _not_full.notify_all();
+        if (_producer.joinable())
+            _producer.join();
+    }
+
+    async_line_reader(async_line_reader const &) = delete;
+    async_line_reader & operator=(async_line_reader const &) = delete;
+
+    inline bool is_open() const
+    {
+        return _is_open;
+    }
+
+    // get the next line without the trailing newline. returns false at the end.
+    inline bool getline(std::string & line)
+    {
+        while (_pos >= _chunk.size())
+        {
+            if (!_next_chunk())
+                return false;
+        }
+        size_t end_pos = _chunk.find('\n', _pos);
+        // every chunk ends with a newline, see _produce()
+        line.assign(_chunk, _pos, end_pos - _pos);
+        _pos = end_pos + 1;
+        return true;
+    }
+
+private:
+    VirtualStream<char, Input>  _stream;
+    std::thread                 _producer;
+    std::mutex                  _mutex;
+    std::condition_variable     _not_empty;
+    std::condition_variable     _not_full;
+    std::deque<std::string>     _chunks;
+    std::string                 _chunk;
+    size_t                      _pos                = 0;
+    size_t                      _chunk_size;
+    size_t                      _max_queued_chunks;
+    bool                        _is_open            = false;
+    bool                        _done               = false;
+    bool                        _stop               = false;
+
+    // take the next chunk from the queue (blocks while the producer is busy)
+    inline bool _next_chunk()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this]{ return !_chunks.empty() || _done; });
+        if (_chunks.empty())
+            return false;
+        _chunk = std::move(_chunks.front());
+        _chunks.pop_front();
+        _pos = 0;
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+    }
+
+    // decompress the input and cut it into chunks that end on a newline
+    inline void _produce()
+    {
+        std::string carry;
+        while (true)
+        {
+            std::string chunk(std::move(carry));
+            size_t filled = chunk.size();
+            chunk.resize(filled + _chunk_size);
+            _stream.read(&chunk[filled], _chunk_size);
+            filled += _stream.gcount();
+            chunk.resize(filled);
+
+            bool at_end = !_stream;
+            size_t last_newline = chunk.rfind('\n');
+            if (at_end)
+            {
+                if (!chunk.empty() && chunk.back() != '\n')
+                    chunk.push_back('\n');
+            }
+            else if (last_newline == std::string::npos)
+            {
+                // a single line longer than a chunk. keep reading.
+                carry = std::move(chunk);
+                continue;
+            }
+            else
+            {
+                carry.assign(chunk, last_newline + 1, std::string::npos);
+                chunk.resize(last_newline + 1);
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _not_full.wait(lock, [this]{ return _chunks.size() < _max_queued_chunks || _stop; });
+            if (_stop || at_end)
+            {
+                if (!_stop && !chunk.empty())
+                    _chunks.push_back(std::move(chunk));
+                _done = true;
+                lock.unlock();
+                _not_empty.notify_all();
+                return;
+            }
+            _chunks.push_back(std::move(chunk));
+            lock.unlock();
+            _not_empty.notify_one();
+        }
+    }
+};
+
+#endif /* LINE_READER_H */
@@ -2,16 +2,27 @@ using namespace seqan;
 
 typedef std::unordered_map <uint32_t, std::pair<uint32_t, std::string> > TNodes;
 uint32_t const LINAGE_LENGTH = 8;
+typedef std::array<uint32_t, LINAGE_LENGTH> TLinage;
 
+// written at the start of every slimm database file followed by the format version
+char const      SLIMM_DB_MAGIC[8]       = {'S', 'L', 'I', 'M', 'M', 'D', 'B', '\0'};
+uint32_t const  SLIMM_DB_FORMAT_VERSION = 2;
+
+#include <array>
+#include <limits>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <map>
+#include <stdexcept>
 #include <utility>
 
 #include <cereal/types/common.hpp>
 #include <cereal/types/tuple.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/array.hpp>
+#include <cereal/types/utility.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/memory.hpp>
@@ -74,29 +85,156 @@ std::string from_taxa_ranks_short(const taxa_ranks &rnk)
     else                              return "i";
 }
 
+std::string get_accession_id(CharString const & sequence_name);
+
 struct slimm_database
 {
 public:
+    static uint32_t const NOT_FOUND = std::numeric_limits<uint32_t>::max();
+
     // maps accession number to a vector of taxon ids from species to superkingdom
     std::unordered_map<std::string, std::vector<uint32_t> >             ac__taxid;
 
-    // maps taxon ids to a tuple of their rank and name
-    std::unordered_map<uint32_t, std::tuple<taxa_ranks, std::string> >  taxid__name;
+    // taxon ids in ascending order. the position of a taxon id is its dense id
+    std::vector<uint32_t>                                               taxids;
+
+    // ranks of the taxa by dense id
+    std::vector<uint8_t>                                                taxon_ranks;
+
+    // names of all taxa back to back. the name of the taxon with the dense
+    // id i is names[name_offsets[i], name_offsets[i+1])
+    std::vector<uint32_t>                                               name_offsets;
+    std::string                                                         names;
+
+    // optional reference metadata (slimm_build --ref-metadata)
+    // maps sequence names as they appear in SAM/BAM headers to accessions
+    std::unordered_map<std::string, std::string>                        ref_name__ac;
+
+    // maps accessions to the length of their sequences
+    std::unordered_map<std::string, uint32_t>                           ac__length;
+
+    // average length of the references under each taxon by dense id
+    std::vector<uint32_t>                                               genome_lengths;
 
     template <class Archive>
     void save( Archive & ar ) const
     {
         ar(ac__taxid);
-        ar(taxid__name);
+        ar(taxids);
+        ar(taxon_ranks);
+        ar(name_offsets);
+        ar(names);
+        ar(ref_name__ac);
+        ar(ac__length);
+        ar(genome_lengths);
     }
 
     template <class Archive>
     void load( Archive & ar )
     {
+        ar(ac__taxid);
+        ar(taxids);
+        ar(taxon_ranks);
+        ar(name_offsets);
+        ar(names);
+        ar(ref_name__ac);
+        ar(ac__length);
+        ar(genome_lengths);
+    }
+
+    // databases of older slimm_build versions: version 0 (no magic string) has
+    // only the taxonomy, version 1 keeps the names and genome lengths by taxon id
+    template <class Archive>
+    void load_legacy( Archive & ar, uint32_t version )
+    {
+        std::unordered_map<uint32_t, std::tuple<taxa_ranks, std::string> >  taxid__name;
         ar(ac__taxid);
         ar(taxid__name);
+        set_taxa(taxid__name);
+        if (version == 0)
+            return;
+
+        std::unordered_map<uint32_t, uint32_t>  taxid__genome_length;
+        ar(ref_name__ac);
+        ar(ac__length);
+        ar(taxid__genome_length);
+        genome_lengths.assign(taxids.size(), 0);
+        for (auto const & tid_length : taxid__genome_length)
+        {
+            uint32_t taxon_idx = taxon_index(tid_length.first);
+            if (taxon_idx != NOT_FOUND)
+                genome_lengths[taxon_idx] = tid_length.second;
+        }
+    }
+
+    // replaces all taxa with the ones in taxid__name
+    template <typename TMap>
+    inline void set_taxa(TMap const & taxid__name)
+    {
+        taxids.clear();
+        taxids.reserve(taxid__name.size());
+        for (auto const & tid_name : taxid__name)
+            taxids.push_back(tid_name.first);
+        std::sort(taxids.begin(), taxids.end());
+
+        taxon_ranks.clear();
+        names.clear();
+        name_offsets.assign(1, 0);
+        genome_lengths.clear();
+        for (uint32_t taxid : taxids)
+        {
+            auto const & rank_name = taxid__name.at(taxid);
+            taxon_ranks.push_back(static_cast<uint8_t>(std::get<0>(rank_name)));
+            names += std::get<1>(rank_name);
+            name_offsets.push_back(names.size());
+        }
+    }
+
+    // returns the dense id of a taxon or NOT_FOUND
+    inline uint32_t taxon_index(uint32_t taxid) const
+    {
+        auto tid_pos = std::lower_bound(taxids.begin(), taxids.end(), taxid);
+        if (tid_pos == taxids.end() || *tid_pos != taxid)
+            return NOT_FOUND;
+        return tid_pos - taxids.begin();
+    }
+
+    // rank of a taxon. unknown taxa are strains
+    inline taxa_ranks taxon_rank(uint32_t taxid) const
+    {
+        uint32_t taxon_idx = taxon_index(taxid);
+        return taxon_idx == NOT_FOUND ? strain_lv : static_cast<taxa_ranks>(taxon_ranks[taxon_idx]);
+    }
+
+    // scientific name of a taxon. unknown taxa have no name
+    inline std::string taxon_name(uint32_t taxid) const
+    {
+        uint32_t taxon_idx = taxon_index(taxid);
+        if (taxon_idx == NOT_FOUND)
+            return std::string();
+        return names.substr(name_offsets[taxon_idx], name_offsets[taxon_idx + 1] - name_offsets[taxon_idx]);
+    }
+
+    // returns the accession of a reference given its name in a SAM/BAM header
+    inline std::string get_accession(CharString const & ref_name) const
+    {
+        if (!ref_name__ac.empty())
+        {
+            auto ac_pos = ref_name__ac.find(toCString(ref_name));
+            if (ac_pos != ref_name__ac.end())
+                return ac_pos->second;
+        }
+        return get_accession_id(ref_name);
     }
 
+    // returns the precomputed genome length of a taxon or 0 if there is none
+    inline uint32_t get_genome_length(uint32_t taxid) const
+    {
+        uint32_t taxon_idx = taxon_index(taxid);
+        if (taxon_idx == NOT_FOUND || taxon_idx >= genome_lengths.size())
+            return 0;
+        return genome_lengths[taxon_idx];
+    }
 };
 
 template <typename TTarget, typename TString, typename TKey = uint32_t, typename TValue = uint32_t>
@@ -178,7 +316,9 @@ TNodes load_node_maps(std::string const & filePath)
 inline void save_slimm_database(slimm_database const & slimm_db, std::string const & output_path)
 {
     std::ofstream os(output_path, std::ios::binary);
+    os.write(SLIMM_DB_MAGIC, sizeof(SLIMM_DB_MAGIC));
     cereal::BinaryOutputArchive out_archive( os );
+    out_archive(SLIMM_DB_FORMAT_VERSION);
     out_archive(slimm_db);
     os.close();
 }
@@ -186,12 +326,109 @@ inline void save_slimm_database(slimm_database const & slimm_db, std::string con
 // --------------------------------------------------------------------------
 // Function load_slimm_database()
 // --------------------------------------------------------------------------
-inline void load_slimm_database(slimm_database & slimm_db, std::string const & input_path)
+// returns false if the file can not be read as a database
+inline bool load_slimm_database(slimm_database & slimm_db, std::string const & input_path)
 {
     std::ifstream is(input_path, std::ios::binary);
+    if (!is.is_open())
+    {
+        std::cerr << "Could not open " << input_path << "!\n";
+        return false;
+    }
+    char magic[sizeof(SLIMM_DB_MAGIC)] = {};
+    uint32_t version = 0;
+    is.read(magic, sizeof(magic));
+    bool has_magic = is.gcount() == sizeof(magic) && std::equal(magic, magic + sizeof(magic), SLIMM_DB_MAGIC);
+    // databases without the magic string are read from the start
+    if (!has_magic)
+    {
+        is.clear();
+        is.seekg(0);
+    }
     cereal::BinaryInputArchive in_archive(is);
-    in_archive(slimm_db);
+    if (has_magic)
+        in_archive(version);
+    if (version > SLIMM_DB_FORMAT_VERSION)
+    {
+        std::cerr << input_path << " was built by a newer version of slimm_build.\n"
+                  << "Please rebuild the database with this version of slimm_build.\n";
+        return false;
+    }
+    try
+    {
+        if (version == SLIMM_DB_FORMAT_VERSION)
+            in_archive(slimm_db);
+        else
+            slimm_db.load_legacy(in_archive, version);
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << input_path << " is not a slimm database (" << e.what() << ").\n";
+        return false;
+    }
     is.close();
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function get_thread_id()
+// --------------------------------------------------------------------------
+inline uint32_t get_thread_id()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// --------------------------------------------------------------------------
+// Function get_max_threads()
+// --------------------------------------------------------------------------
+inline uint32_t get_max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// --------------------------------------------------------------------------
+// Function parallel_for_tasks()
+// --------------------------------------------------------------------------
+// calls f(i) for every i in [0, count). inside a parallel region (e.g. in a
+// task of slimm::task_profiles()) the calls become tasks that idle threads of
+// the region steal, otherwise they are a dynamically scheduled parallel loop.
+template <typename TFunction>
+inline void parallel_for_tasks(int64_t count, TFunction const & f)
+{
+#ifdef _OPENMP
+    if (omp_in_parallel())
+    {
+        for (int64_t i=0; i < count; ++i)
+        {
+            #pragma omp task firstprivate(i) shared(f)
+            f(i);
+        }
+        #pragma omp taskwait
+        return;
+    }
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (int64_t i=0; i < count; ++i)
+        f(i);
+}
+
+// the q-th quantile of the values in v (nearest rank)
+template <typename Type>
+Type get_quantile (std::vector<Type> v, float q)
+{
+    if (v.empty())
+        return 0;
+    size_t i = std::lround(q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
 }
 
 template <typename Type>
@@ -506,6 +743,22 @@ inline bool read_bam_file(BamFileIn & bam_file, BamHeader & bam_header, std::str
     return true;
 }
 
+// the greatest common divisor of the values that are not 0, 0 if there are none
+inline uint32_t greatest_common_divisor(std::vector<uint32_t> const & values)
+{
+    uint32_t divisor = 0;
+    for (auto value : values)
+    {
+        for (uint32_t w = value; w != 0; )
+        {
+            uint32_t r = divisor % w;
+            divisor = w;
+            w = r;
+        }
+    }
+    return divisor;
+}
+
 inline uint32_t get_avg_read_length(BamFileIn & bam_file, uint32_t const sample_size)
 {
     BamAlignmentRecord record;
@@ -528,10 +781,9 @@ inline uint32_t get_taxon_id_pos(CharString const & accession)
     {
         if (!get_taxon_id(taxon_id_pos, accession, "kraken:taxid"))
         {
-            std::cerr<<"Unable to find a way to resolve taxon id associated with references.\n"
-            <<"Make sure you used a set of references provided with SLIMM\n"
-            <<"or generated by the preprocessing script.\n";
-            exit(1);
+            throw std::runtime_error("Unable to find a way to resolve taxon id associated with references.\n"
+                                     "Make sure you used a set of references provided with SLIMM\n"
+                                     "or generated by the preprocessing script.");
         }
     }
     return taxon_id_pos;
@@ -0,0 +1,213 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef PARTIAL_STATE_H
+#define PARTIAL_STATE_H
+
+using namespace seqan;
+
+// written at the start of every partial state followed by the format version
+char const      SLIMM_PARTIAL_MAGIC[8]          = {'S', 'L', 'I', 'M', 'M', 'P', 'S', '\0'};
+uint32_t const  SLIMM_PARTIAL_FORMAT_VERSION    = 1;
+// the number of reads get_avg_read_length() looks at
+uint32_t const  READ_LENGTH_SAMPLE_SIZE         = 100000;
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Function read_name_hash()
+// ----------------------------------------------------------------------------
+// FNV-1a with a final mix: the same on every node, unlike std::hash
+inline uint64_t read_name_hash(char const * name, size_t name_length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i=0; i < name_length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class partial_state
+// ----------------------------------------------------------------------------
+// the alignments of one shard of a sample (e.g. a lane) as written by slimm
+// map. the hits are kept with their begin positions and grouped by read, the
+// bins are only known once all shards are read by slimm reduce. replaying the
+// shards in order gives the reads and coverages of the concatenated input.
+class partial_state
+{
+public:
+    // the header of the SAM/BAM file, the same for all shards of a sample
+    std::vector<std::string>    contig_names;
+    std::vector<uint32_t>       contig_lengths;
+    // the lengths of the first READ_LENGTH_SAMPLE_SIZE reads with a sequence
+    std::vector<uint32_t>       sampled_read_lengths;
+    uint32_t                    hits_count = 0;
+
+    // the hash of a read name with the mate (0, 1 or 2) in the lowest two bits.
+    // the hits of read i are hit_offsets[i] to hit_offsets[i+1], in file order.
+    std::vector<uint64_t>       read_keys;
+    std::vector<uint32_t>       hit_offsets;
+    std::vector<uint32_t>       hit_refs;
+    std::vector<uint32_t>       hit_positions;
+
+    inline bool same_references(partial_state const & other) const
+    {
+        return contig_names == other.contig_names && contig_lengths == other.contig_lengths;
+    }
+
+    // read the header of a partial state, the reads only if with_reads is set
+    inline bool load(std::string const & partial_path, bool with_reads);
+    inline bool save(std::string const & partial_path) const;
+    inline bool map_alignments(std::string const & bam_path);
+};
+
+// load a state written by save(), the reads are skipped unless with_reads
+inline bool partial_state::load(std::string const & partial_path, bool with_reads)
+{
+    std::ifstream is(partial_path, std::ios::binary);
+    if (!is.is_open())
+    {
+        std::cerr << "Could not open " << partial_path << "!\n";
+        return false;
+    }
+    char magic[sizeof(SLIMM_PARTIAL_MAGIC)] = {};
+    uint32_t version = 0;
+    is.read(magic, sizeof(magic));
+    if (!std::equal(magic, magic + sizeof(magic), SLIMM_PARTIAL_MAGIC))
+    {
+        std::cerr << partial_path << " is not a partial state written by slimm map.\n";
+        return false;
+    }
+    cereal::BinaryInputArchive in_archive(is);
+    in_archive(version);
+    if (version != SLIMM_PARTIAL_FORMAT_VERSION)
+    {
+        std::cerr << partial_path << " was written by an incompatible version of slimm.\n";
+        return false;
+    }
+    in_archive(contig_names, contig_lengths, sampled_read_lengths, hits_count);
+    if (with_reads)
+        in_archive(read_keys, hit_offsets, hit_refs, hit_positions);
+    return true;
+}
+
+inline bool partial_state::save(std::string const & partial_path) const
+{
+    std::ofstream os(partial_path, std::ios::binary);
+    if (!os.is_open())
+    {
+        std::cerr << "[ERROR!] Unable to open " << partial_path << "\n";
+        return false;
+    }
+    os.write(SLIMM_PARTIAL_MAGIC, sizeof(SLIMM_PARTIAL_MAGIC));
+    cereal::BinaryOutputArchive out_archive(os);
+    out_archive(SLIMM_PARTIAL_FORMAT_VERSION);
+    out_archive(contig_names, contig_lengths, sampled_read_lengths, hits_count);
+    out_archive(read_keys, hit_offsets, hit_refs, hit_positions);
+    return bool(os);
+}
+
+// read the mapped records of a SAM/BAM file and group their hits by read
+inline bool partial_state::map_alignments(std::string const & bam_path)
+{
+    BamFileIn bam_file;
+    BamHeader bam_header;
+    if (!read_bam_file(bam_file, bam_header, bam_path))
+        return false;
+
+    StringSet<CharString> const & names = contigNames(context(bam_file));
+    contig_names.clear();
+    contig_lengths.clear();
+    for (uint32_t i=0; i < length(names); ++i)
+    {
+        contig_names.push_back(toCString(names[i]));
+        contig_lengths.push_back(contigLengths(context(bam_file))[i]);
+    }
+
+    struct hit
+    {
+        uint64_t read_key;
+        uint32_t ref_id;
+        uint32_t begin_pos;
+    };
+    std::vector<hit> hits;
+    BamAlignmentRecord record;
+    while (!atEnd(bam_file))
+    {
+        readRecord(record, bam_file);
+        // as get_avg_read_length() on the concatenated input
+        if (sampled_read_lengths.size() < READ_LENGTH_SAMPLE_SIZE && length(record.seq) > 0)
+            sampled_read_lengths.push_back(length(record.seq));
+        if (hasFlagUnmapped(record) || record.rID == BamAlignmentRecord::INVALID_REFID)
+            continue;  // Skip these records.
+        uint64_t mate = hasFlagFirst(record) ? 1 : (hasFlagLast(record) ? 2 : 0);
+        uint64_t key = read_name_hash(toCString(record.qName), length(record.qName));
+        hits.push_back({(key & ~uint64_t(3)) | mate, uint32_t(record.rID), uint32_t(record.beginPos)});
+    }
+    hits_count = hits.size();
+
+    // stable: the hits of a read stay in file order
+    std::stable_sort(hits.begin(), hits.end(), [](hit const & a, hit const & b)
+                     { return a.read_key < b.read_key; });
+    read_keys.clear();
+    hit_offsets.clear();
+    hit_refs.resize(hits.size());
+    hit_positions.resize(hits.size());
+    for (uint32_t i=0; i < hits.size(); ++i)
+    {
+        if (i == 0 || hits[i].read_key != hits[i-1].read_key)
+        {
+            read_keys.push_back(hits[i].read_key);
+            hit_offsets.push_back(i);
+        }
+        hit_refs[i] = hits[i].ref_id;
+        hit_positions[i] = hits[i].begin_pos;
+    }
+    hit_offsets.push_back(hits.size());
+    return true;
+}
+
+#endif /* PARTIAL_STATE_H */
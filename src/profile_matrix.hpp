@@ -0,0 +1,272 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef PROFILE_MATRIX_H
+#define PROFILE_MATRIX_H
+
+#include <algorithm>
+#include <numeric>
+
+using namespace seqan;
+
+// written at the start of every binary profile matrix followed by the format version
+char const      SLIMM_MATRIX_MAGIC[8]       = {'S', 'L', 'I', 'M', 'M', 'M', 'T', 'X'};
+uint32_t const  SLIMM_MATRIX_FORMAT_VERSION = 2;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class profile_matrix
+// ----------------------------------------------------------------------------
+// taxa x samples matrix of the values of many slimm profiles. only the non
+// zero entries are kept, sample by sample (compressed sparse columns). the
+// values are doubles, so read counts are kept exactly.
+class profile_matrix
+{
+public:
+    std::vector<std::string>    samples;
+
+    // one row per distinct linage over all samples
+    std::vector<std::string>    row_levels;
+    std::vector<std::string>    row_taxa_ids;
+    std::vector<std::string>    row_linages;
+
+    // entries of sample i are in [sample_offsets[i], sample_offsets[i+1])
+    std::vector<uint64_t>       sample_offsets = {0};
+    std::vector<uint32_t>       entry_rows;
+    std::vector<double>         entry_values;
+
+    inline uint32_t rows_count() const
+    {
+        return row_linages.size();
+    }
+
+    // stream a profile in as the next sample. value_column is 3 for
+    // abundances and 4 for read counts.
+    inline bool add_profile(std::string const & profile_path,
+                            std::string const & sample_name,
+                            uint32_t value_column)
+    {
+        std::ifstream profile_stream(profile_path);
+        if (!profile_stream.is_open())
+            return false;
+
+        std::string line;
+        std::getline(profile_stream, line); // header
+        std::unordered_map<uint32_t, double> row__value;
+        std::vector<std::string> fields;
+        while (std::getline(profile_stream, line))
+        {
+            _split(fields, line);
+            if (fields.size() <= value_column)
+                continue;
+            double value = std::strtod(fields[value_column].c_str(), nullptr);
+            if (value == 0)
+                continue;
+
+            auto found = _linage__row.find(fields[2]);
+            if (found == _linage__row.end())
+            {
+                found = _linage__row.emplace(fields[2], rows_count()).first;
+                row_levels.push_back(fields[0]);
+                row_taxa_ids.push_back(fields[1]);
+                row_linages.push_back(fields[2]);
+            }
+            row__value[found->second] += value;
+        }
+
+        size_t first = entry_rows.size();
+        for (auto const & rv : row__value)
+        {
+            entry_rows.push_back(rv.first);
+            entry_values.push_back(rv.second);
+        }
+        // keep the rows of a sample sorted
+        std::vector<size_t> order(entry_rows.size() - first);
+        std::iota(order.begin(), order.end(), first);
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b){ return entry_rows[a] < entry_rows[b]; });
+        std::vector<uint32_t> rows(order.size());
+        std::vector<double> values(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            rows[i] = entry_rows[order[i]];
+            values[i] = entry_values[order[i]];
+        }
+        std::copy(rows.begin(), rows.end(), entry_rows.begin() + first);
+        std::copy(values.begin(), values.end(), entry_values.begin() + first);
+
+        samples.push_back(sample_name);
+        sample_offsets.push_back(entry_rows.size());
+        return true;
+    }
+
+    // rows ordered by taxa level and then by decreasing total value. the
+    // values are written with all their digits.
+    inline void write_tsv(buffered_writer & out) const
+    {
+        // transpose to rows
+        std::vector<uint64_t> row_offsets(rows_count() + 1, 0);
+        for (uint32_t row : entry_rows)
+            ++row_offsets[row + 1];
+        std::partial_sum(row_offsets.begin(), row_offsets.end(), row_offsets.begin());
+        std::vector<uint32_t> row_samples(entry_rows.size());
+        std::vector<double> row_values(entry_rows.size());
+        std::vector<double> row_totals(rows_count(), 0.0);
+        {
+            std::vector<uint64_t> next(row_offsets.begin(), row_offsets.end() - 1);
+            for (uint32_t s = 0; s < samples.size(); ++s)
+            {
+                for (uint64_t e = sample_offsets[s]; e < sample_offsets[s + 1]; ++e)
+                {
+                    uint32_t row = entry_rows[e];
+                    row_samples[next[row]] = s;
+                    row_values[next[row]++] = entry_values[e];
+                    row_totals[row] += entry_values[e];
+                }
+            }
+        }
+
+        std::vector<uint32_t> order(rows_count());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            if (row_levels[a] != row_levels[b])
+                return row_levels[a] > row_levels[b];
+            if (row_totals[a] != row_totals[b])
+                return row_totals[a] > row_totals[b];
+            return row_linages[a] < row_linages[b];
+        });
+
+        out << "taxa_level\ttaxa_id\tlinage";
+        for (auto const & sample : samples)
+            out << "\t" << sample;
+        out << "\n";
+        for (uint32_t row : order)
+        {
+            out << row_levels[row] << "\t" << row_taxa_ids[row] << "\t" << row_linages[row];
+            uint32_t s = 0;
+            for (uint64_t e = row_offsets[row]; e < row_offsets[row + 1]; ++e)
+            {
+                for (; s < row_samples[e]; ++s)
+                    out << "\t0";
+                out << '\t';
+                out.write_double(row_values[e]);
+                ++s;
+            }
+            for (; s < samples.size(); ++s)
+                out << "\t0";
+            out << "\n";
+        }
+    }
+
+    template<class Archive>
+    void serialize(Archive & archive)
+    {
+        archive(samples, row_levels, row_taxa_ids, row_linages, sample_offsets, entry_rows, entry_values);
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t>   _linage__row;
+
+    inline static void _split(std::vector<std::string> & fields, std::string const & line)
+    {
+        fields.clear();
+        size_t begin = 0;
+        while (true)
+        {
+            size_t end = line.find('\t', begin);
+            fields.push_back(line.substr(begin, end - begin));
+            if (end == std::string::npos)
+                break;
+            begin = end + 1;
+        }
+    }
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function save_profile_matrix()
+// --------------------------------------------------------------------------
+inline bool save_profile_matrix(profile_matrix const & matrix, std::string const & output_path)
+{
+    std::ofstream os(output_path, std::ios::binary);
+    if (!os.is_open())
+        return false;
+    os.write(SLIMM_MATRIX_MAGIC, sizeof(SLIMM_MATRIX_MAGIC));
+    cereal::BinaryOutputArchive out_archive(os);
+    out_archive(SLIMM_MATRIX_FORMAT_VERSION);
+    out_archive(matrix);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function load_profile_matrix()
+// --------------------------------------------------------------------------
+inline bool load_profile_matrix(profile_matrix & matrix, std::string const & input_path)
+{
+    std::ifstream is(input_path, std::ios::binary);
+    if (!is.is_open())
+        return false;
+    char magic[sizeof(SLIMM_MATRIX_MAGIC)] = {};
+    uint32_t version = 0;
+    is.read(magic, sizeof(magic));
+    if (!std::equal(magic, magic + sizeof(magic), SLIMM_MATRIX_MAGIC))
+        return false;
+    cereal::BinaryInputArchive in_archive(is);
+    in_archive(version);
+    if (version == SLIMM_MATRIX_FORMAT_VERSION)
+    {
+        in_archive(matrix);
+    }
+    else if (version == 1)
+    {
+        // version 1 stored the values as floats
+        std::vector<float> values;
+        in_archive(matrix.samples, matrix.row_levels, matrix.row_taxa_ids, matrix.row_linages,
+                   matrix.sample_offsets, matrix.entry_rows, values);
+        matrix.entry_values.assign(values.begin(), values.end());
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+#endif /* PROFILE_MATRIX_H */
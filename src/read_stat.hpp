@@ -59,6 +59,139 @@ public:
 };
 
 
+// ----------------------------------------------------------------------------
+// Class read_class
+// ----------------------------------------------------------------------------
+// a group of reads sharing the same set of target references
+class read_class
+{
+public:
+    typedef std::vector<std::pair<uint32_t, uint32_t> >     TBinCounts;
+
+    // sorted reference ids
+    std::vector<uint32_t>           targets;
+    uint32_t                        count = 0;
+
+    // for every target of a multi-mapping class: the number of reads (second)
+    // whose first match on the target is in a bin (first), sorted by bin.
+    std::vector<TBinCounts>         first_bins;
+
+    template<class Archive>
+    void serialize(Archive & archive)
+    {
+        archive(targets, count, first_bins);
+    }
+
+    // move the first bins to factor times the bin width
+    void coarsen_bins(uint32_t factor)
+    {
+        for (auto & bins : first_bins)
+            for (auto & bin : bins)
+                bin.first /= factor;
+        compact_bins();
+    }
+
+    // sorts and merges the bins collected one read at a time
+    void compact_bins()
+    {
+        for (auto & bins : first_bins)
+        {
+            std::sort(bins.begin(), bins.end());
+            size_t last = 0;
+            for (size_t i = 1; i < bins.size(); ++i)
+            {
+                if (bins[i].first == bins[last].first)
+                    bins[last].second += bins[i].second;
+                else
+                    bins[++last] = bins[i];
+            }
+            if (!bins.empty())
+                bins.resize(last + 1);
+            bins.shrink_to_fit();
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class target_set_hash
+// ----------------------------------------------------------------------------
+// hashes a set of reference ids to find read classes
+struct target_set_hash
+{
+    size_t operator()(std::vector<uint32_t> const & targets) const
+    {
+        size_t seed = targets.size();
+        for (uint32_t target : targets)
+            seed ^= target + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class bins_accumulator
+// ----------------------------------------------------------------------------
+// the bin heights one task adds to a reference. the bins of the first hits are
+// listed, a reference that gets hits for more than a quarter of its bins is hot
+// and switches to dense heights, so no more than the bins of a reference or a
+// quarter of its hits are kept.
+class bins_accumulator
+{
+public:
+    std::vector<uint32_t>   pending_bins;
+    std::vector<uint32_t>   heights;
+
+    inline void add(uint32_t bin_number, uint32_t bins_count)
+    {
+        if (!heights.empty())
+        {
+            ++heights[bin_number];
+            return;
+        }
+        pending_bins.push_back(bin_number);
+        if (pending_bins.size() > bins_count / 4)
+        {
+            heights.assign(bins_count, 0);
+            for (auto pending_bin : pending_bins)
+                ++heights[pending_bin];
+            std::vector<uint32_t>().swap(pending_bins);
+        }
+    }
+
+    // add the heights to the bins of a reference
+    inline void merge_into(std::vector<uint32_t> & bins_height) const
+    {
+        for (size_t i = 0; i < heights.size(); ++i)
+            bins_height[i] += heights[i];
+        for (auto pending_bin : pending_bins)
+            ++bins_height[pending_bin];
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class read_partial
+// ----------------------------------------------------------------------------
+// what one task folds out of some shards of the read table, merged into the
+// references and the read classes once all tasks are done. the bins are kept
+// by reference, only the references a task has seen take space.
+class read_partial
+{
+public:
+    typedef std::unordered_map<uint32_t, bins_accumulator>   TBinsByRef;
+
+    // per reference
+    std::vector<uint32_t>           reads_count;
+    std::vector<uint32_t>           uniq_reads_count;
+    // the bins of all matches and of the first match of unique reads
+    TBinsByRef                      cov_bins;
+    TBinsByRef                      uniq_cov_bins;
+    std::vector<read_class>         classes;
+    std::unordered_map<std::vector<uint32_t>, uint32_t, target_set_hash> target_set__class;
+    uint32_t                        uniq_matches_count = 0;
+    // for --read-output, as in slimm
+    std::string                     read_names;
+    std::vector<uint32_t>           read_name_classes;
+};
+
 // ----------------------------------------------------------------------------
 // Class read_stat
 // ----------------------------------------------------------------------------
@@ -135,4 +268,82 @@ public:
     }
 };
 
+// ----------------------------------------------------------------------------
+// Class read_table
+// ----------------------------------------------------------------------------
+// the reads of a sample by name, sharded by the hash of the name. every shard
+// has its own lock, so many threads can add their hits at the same time.
+class read_table
+{
+public:
+    typedef std::unordered_map<std::string, read_stat>  TShard;
+
+    // shards_count is rounded up to a power of two
+    explicit read_table(uint32_t shards_count = 256)
+    {
+        while ((1u << _shard_bits) < shards_count)
+            ++_shard_bits;
+        _shards = std::vector<_locked_shard>(1u << _shard_bits);
+    }
+
+    // add a match on reference_id to the read read_key. thread-safe.
+    inline void add_target(std::string const & read_key, uint32_t reference_id, uint32_t bin_number)
+    {
+        _locked_shard & shard = _shards[shard_index(read_key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // if there is no read with read_key this will create one.
+        shard.reads[read_key].add_target(reference_id, bin_number);
+    }
+
+    inline uint32_t shards_count() const
+    {
+        return _shards.size();
+    }
+
+    // the shard of read_key. a shard is only filled by one thread at a time
+    // through shard(), the reads of a shard can be added without locks.
+    inline uint32_t shard_index(std::string const & read_key) const
+    {
+        if (_shard_bits == 0)
+            return 0;
+        // fibonacci hashing spreads the bits of the hash over the shards
+        uint64_t hash = std::hash<std::string>()(read_key);
+        return (hash * 11400714819323198485ull) >> (64 - _shard_bits);
+    }
+
+    // not thread-safe, for reading the table once all hits are added or for
+    // filling a shard from a single thread
+    inline TShard & shard(uint32_t i)
+    {
+        return _shards[i].reads;
+    }
+
+    inline size_t size() const
+    {
+        size_t count = 0;
+        for (auto const & shard : _shards)
+            count += shard.reads.size();
+        return count;
+    }
+
+    // remove all reads and free their memory
+    inline void clear()
+    {
+        for (auto & shard : _shards)
+            TShard().swap(shard.reads);
+    }
+
+private:
+    struct _locked_shard
+    {
+        std::mutex  mutex;
+        TShard      reads;
+        // keeps the locks of neighbouring shards off the same cache line
+        char        padding[64];
+    };
+
+    std::vector<_locked_shard>  _shards;
+    uint32_t                    _shard_bits = 0;
+};
+
 #endif /* READ_STAT_H */
@@ -90,6 +90,49 @@ public:
         return _none_zero_bin_count;
     }
 
+    // the coverage at factor times the bin width. bins are summed, which
+    // gives the same heights as binning the reads at the coarser width.
+    bins_coverage coarsen(uint32_t factor) const
+    {
+        bins_coverage coarse;
+        coarse.bin_width = bin_width * factor;
+        coarse.number_of_bins = (number_of_bins - 1) / factor + 1;
+        coarse.bins_height.assign(coarse.number_of_bins, 0);
+        for (uint32_t i=0; i < number_of_bins; ++i)
+            coarse.bins_height[i / factor] += bins_height[i];
+        return coarse;
+    }
+
+    // add the heights of a coverage of the same reference and bin width
+    void add(bins_coverage const & other)
+    {
+        for (uint32_t i=0; i < number_of_bins && i < other.number_of_bins; ++i)
+            bins_height[i] += other.bins_height[i];
+        _none_zero_bin_count = -1;
+    }
+
+    // only the occupied bins are archived
+    template<class Archive>
+    void save(Archive & archive) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t> > occupied_bins;
+        for (uint32_t i=0; i < bins_height.size(); ++i)
+            if (bins_height[i] > 0)
+                occupied_bins.push_back(std::make_pair(i, bins_height[i]));
+        archive(bin_width, number_of_bins, occupied_bins);
+    }
+
+    template<class Archive>
+    void load(Archive & archive)
+    {
+        std::vector<std::pair<uint32_t, uint32_t> > occupied_bins;
+        archive(bin_width, number_of_bins, occupied_bins);
+        bins_height.assign(number_of_bins, 0);
+        for (auto const & bin : occupied_bins)
+            bins_height[bin.first] = bin.second;
+        _none_zero_bin_count = -1;
+    }
+
 private:
     int32_t _none_zero_bin_count = -1;
 };
@@ -101,11 +144,13 @@ class reference_contig
 {
 public:
     std::string         accession;
+    TLinage             linage;
     uint32_t            taxa_id;
     uint32_t            length;
     uint32_t            reads_count;
     uint32_t            uniq_reads_count;
     uint32_t            uniq_reads_count2;
+    uint32_t            em_reads_count;
     bins_coverage       cov;
     bins_coverage       uniq_cov;
     bins_coverage       uniq_cov2;
@@ -114,11 +159,13 @@ public:
     float               uniq_abundance2;
 
     reference_contig(): accession(""),
+                        linage(),
                         taxa_id(0),
                         length(0),
                         reads_count(0),
                         uniq_reads_count(0),
                         uniq_reads_count2(0),
+                        em_reads_count(0),
                         cov(),
                         uniq_cov(),
                         uniq_cov2(),
@@ -126,13 +173,15 @@ public:
                         uniq_abundance(0.0),
                         uniq_abundance2(0.0){}
 
-    reference_contig(std::string & ref_name, uint32_t & t_id, uint32_t & ref_length, uint32_t & bin_width):
+    reference_contig(std::string & ref_name, TLinage const & ref_linage, uint32_t & ref_length, uint32_t & bin_width):
                         accession(ref_name),
-                        taxa_id(t_id),
+                        linage(ref_linage),
+                        taxa_id(ref_linage[0]),
                         length(ref_length),
                         reads_count(0),
                         uniq_reads_count(0),
                         uniq_reads_count2(0),
+                        em_reads_count(0),
                         abundance(0.0),
                         uniq_abundance(0.0),
                         uniq_abundance2(0.0) 
@@ -144,7 +193,32 @@ public:
                             uniq_cov2 = tmp_cov;
                         }
 
+    // the state of a reference after reading the alignments
+    template<class Archive>
+    void serialize(Archive & archive)
+    {
+        archive(accession, linage, taxa_id, length, reads_count, uniq_reads_count,
+                cov, uniq_cov, abundance, uniq_abundance);
+    }
+
     //Member functions
+    // pool the reads of the same reference in another sample
+    inline void pool(reference_contig const & other)
+    {
+        reads_count += other.reads_count;
+        uniq_reads_count += other.uniq_reads_count;
+        cov.add(other.cov);
+        uniq_cov.add(other.uniq_cov);
+    }
+
+    // move the coverages to a multiple of the current bin width
+    inline void coarsen(uint32_t factor)
+    {
+        cov = cov.coarsen(factor);
+        uniq_cov = uniq_cov.coarsen(factor);
+        uniq_cov2 = bins_coverage(length, cov.bin_width);
+    }
+
     inline float cov_percent()
     {
         return float(cov.none_zero_bin_count())/cov.number_of_bins;        
@@ -206,4 +280,30 @@ private:
         return mean(bHeights);
     }
 };
+
+// ----------------------------------------------------------------------------
+// Class taxon_stat
+// ----------------------------------------------------------------------------
+// the reads assigned to a taxon and a summary of the references behind them
+class taxon_stat
+{
+public:
+    uint32_t            read_count          = 0;
+    uint32_t            first_child         = 0;
+    uint32_t            last_child          = 0;
+    uint32_t            children_count      = 0;
+    uint64_t            children_length     = 0;
+
+    // references must be added in increasing order of their ids
+    inline void add_child(uint32_t ref_id, uint32_t ref_length)
+    {
+        if (children_count > 0 && last_child == ref_id)
+            return;
+        if (children_count == 0)
+            first_child = ref_id;
+        last_child = ref_id;
+        ++children_count;
+        children_length += ref_length;
+    }
+};
 #endif /* REFERENCE_CONTIG_H */
@@ -0,0 +1,514 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SHARED_DATABASE_H
+#define SHARED_DATABASE_H
+
+#include <cstring>
+#include <atomic>
+#include <limits>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+using namespace seqan;
+
+// written at the start of a database image once it is complete
+char const      SLIMM_DB_IMAGE_MAGIC[8]     = {'S', 'L', 'I', 'M', 'M', 'I', 'M', 'G'};
+uint32_t const  SLIMM_DB_IMAGE_VERSION      = 1;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class db_image_header
+// ----------------------------------------------------------------------------
+// A database image is a single position independent block of memory holding
+// flat, sorted arrays. Sections are addressed by their byte offsets from the
+// start of the image.
+struct db_image_header
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    linage_length;
+    uint64_t    size;
+    uint64_t    accession_count;
+    uint64_t    taxon_count;
+    uint64_t    ref_name_count;
+
+    uint64_t    accession_offsets;      // uint64_t[accession_count + 1]
+    uint64_t    accession_pool;         // char[]
+    uint64_t    linages;                // uint32_t[accession_count * LINAGE_LENGTH]
+    uint64_t    accession_lengths;      // uint32_t[accession_count]
+    uint64_t    taxids;                 // uint32_t[taxon_count] sorted
+    uint64_t    taxon_ranks;            // uint8_t[taxon_count]
+    uint64_t    name_offsets;           // uint64_t[taxon_count + 1]
+    uint64_t    name_pool;              // char[]
+    uint64_t    genome_lengths;         // uint32_t[taxon_count]
+    uint64_t    ref_name_offsets;       // uint64_t[ref_name_count + 1]
+    uint64_t    ref_name_pool;          // char[]
+    uint64_t    ref_name_accessions;    // uint32_t[ref_name_count]
+};
+
+// ----------------------------------------------------------------------------
+// Class db_image
+// ----------------------------------------------------------------------------
+// A read-only view of a slimm database. The image is either built privately
+// from a loaded slimm_database or attached from a named POSIX shared memory
+// segment (or a file e.g. on a hugetlbfs mount) published by slimm_shm, in
+// which case all the processes on a node share a single copy.
+class db_image
+{
+public:
+    static uint32_t const NOT_FOUND = std::numeric_limits<uint32_t>::max();
+
+    // a name inside the image. refers to the image without copying
+    struct name_ref
+    {
+        char const *    data;
+        size_t          size;
+
+        inline bool empty() const
+        {
+            return size == 0;
+        }
+    };
+
+    db_image() {}
+
+    ~db_image()
+    {
+        _unmap();
+    }
+
+    db_image(db_image const &) = delete;
+    db_image & operator=(db_image const &) = delete;
+
+    inline void build(slimm_database const & slimm_db);
+    inline bool attach(std::string const & segment_name);
+    inline bool publish(std::string const & segment_name) const;
+    inline static bool remove(std::string const & segment_name);
+
+    inline bool is_shared() const
+    {
+        return _mapped_size != 0;
+    }
+
+    inline uint64_t size() const
+    {
+        return _header == nullptr ? 0 : _header->size;
+    }
+
+    // index of accession or NOT_FOUND
+    inline uint32_t find_accession(std::string const & accession) const
+    {
+        return _find_string(accession, _header->accession_count,
+                            _section<uint64_t>(_header->accession_offsets),
+                            _section<char>(_header->accession_pool));
+    }
+
+    // the taxon ids from strain to superkingdom of an accession
+    inline uint32_t const * linage(uint32_t accession_index) const
+    {
+        return _section<uint32_t>(_header->linages) + uint64_t(accession_index) * LINAGE_LENGTH;
+    }
+
+    inline uint32_t accession_length(uint32_t accession_index) const
+    {
+        return _section<uint32_t>(_header->accession_lengths)[accession_index];
+    }
+
+    // index of taxid or NOT_FOUND
+    inline uint32_t find_taxon(uint32_t taxid) const
+    {
+        uint32_t const * first = _section<uint32_t>(_header->taxids);
+        uint32_t const * last = first + _header->taxon_count;
+        uint32_t const * pos = std::lower_bound(first, last, taxid);
+        if (pos == last || *pos != taxid)
+            return NOT_FOUND;
+        return pos - first;
+    }
+
+    // rank of a taxon. unknown taxa are strains
+    inline taxa_ranks taxon_rank(uint32_t taxid) const
+    {
+        uint32_t taxon_index = find_taxon(taxid);
+        if (taxon_index == NOT_FOUND)
+            return strain_lv;
+        return static_cast<taxa_ranks>(_section<uint8_t>(_header->taxon_ranks)[taxon_index]);
+    }
+
+    // scientific name of a taxon. unknown taxa have no name
+    inline name_ref taxon_name_ref(uint32_t taxid) const
+    {
+        uint32_t taxon_index = find_taxon(taxid);
+        if (taxon_index == NOT_FOUND)
+            return name_ref{nullptr, 0};
+        uint64_t const * offsets = _section<uint64_t>(_header->name_offsets);
+        return name_ref{_section<char>(_header->name_pool) + offsets[taxon_index],
+                        offsets[taxon_index + 1] - offsets[taxon_index]};
+    }
+
+    inline std::string taxon_name(uint32_t taxid) const
+    {
+        name_ref name = taxon_name_ref(taxid);
+        return std::string(name.data, name.size);
+    }
+
+    // precomputed genome length of a taxon or 0 if there is none
+    inline uint32_t genome_length(uint32_t taxid) const
+    {
+        uint32_t taxon_index = find_taxon(taxid);
+        if (taxon_index == NOT_FOUND)
+            return 0;
+        return _section<uint32_t>(_header->genome_lengths)[taxon_index];
+    }
+
+    inline bool has_genome_lengths() const
+    {
+        return _has_genome_lengths;
+    }
+
+    // accession of a reference given its name in a SAM/BAM header
+    inline std::string get_accession(CharString const & ref_name) const
+    {
+        if (_header->ref_name_count > 0)
+        {
+            uint32_t ref_index = _find_string(toCString(ref_name), _header->ref_name_count,
+                                              _section<uint64_t>(_header->ref_name_offsets),
+                                              _section<char>(_header->ref_name_pool));
+            if (ref_index != NOT_FOUND)
+            {
+                uint32_t ac_index = _section<uint32_t>(_header->ref_name_accessions)[ref_index];
+                uint64_t const * offsets = _section<uint64_t>(_header->accession_offsets);
+                return std::string(_section<char>(_header->accession_pool) + offsets[ac_index],
+                                   offsets[ac_index + 1] - offsets[ac_index]);
+            }
+        }
+        return get_accession_id(ref_name);
+    }
+
+private:
+    db_image_header const *     _header             = nullptr;
+    std::vector<uint64_t>       _private_image;
+    void *                      _mapped_address     = nullptr;
+    size_t                      _mapped_size        = 0;
+    bool                        _has_genome_lengths = false;
+
+    template <typename TValue>
+    inline TValue const * _section(uint64_t offset) const
+    {
+        return reinterpret_cast<TValue const *>(reinterpret_cast<char const *>(_header) + offset);
+    }
+
+    inline static uint32_t _find_string(std::string const & key,
+                                        uint64_t count,
+                                        uint64_t const * offsets,
+                                        char const * pool)
+    {
+        uint64_t first = 0, last = count;
+        while (first < last)
+        {
+            uint64_t middle = first + (last - first) / 2;
+            int cmp = key.compare(0, std::string::npos, pool + offsets[middle], offsets[middle + 1] - offsets[middle]);
+            if (cmp == 0)
+                return middle;
+            if (cmp < 0)
+                last = middle;
+            else
+                first = middle + 1;
+        }
+        return NOT_FOUND;
+    }
+
+    inline void _set_header(db_image_header const * header)
+    {
+        _header = header;
+        uint32_t const * lengths = _section<uint32_t>(_header->genome_lengths);
+        _has_genome_lengths = std::any_of(lengths, lengths + _header->taxon_count,
+                                          [](uint32_t len){ return len != 0; });
+    }
+
+    inline void _unmap()
+    {
+#ifndef _WIN32
+        if (_mapped_size != 0)
+            munmap(_mapped_address, _mapped_size);
+#endif
+        _mapped_address = nullptr;
+        _mapped_size = 0;
+    }
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+inline std::ostream & operator<<(std::ostream & os, db_image::name_ref const & name)
+{
+    return os.write(name.data, name.size);
+}
+
+// --------------------------------------------------------------------------
+// Function append_image_section()
+// --------------------------------------------------------------------------
+// appends the bytes of values to image aligned to 8 bytes. returns the offset.
+template <typename TValue>
+inline uint64_t append_image_section(std::vector<char> & image, TValue const * values, uint64_t count)
+{
+    uint64_t offset = (image.size() + 7) & ~uint64_t(7);
+    image.resize(offset + count * sizeof(TValue), 0);
+    if (count > 0)
+        std::memcpy(image.data() + offset, values, count * sizeof(TValue));
+    return offset;
+}
+
+// --------------------------------------------------------------------------
+// Function db_image::build()
+// --------------------------------------------------------------------------
+inline void db_image::build(slimm_database const & slimm_db)
+{
+    _unmap();
+    db_image_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.version = SLIMM_DB_IMAGE_VERSION;
+    header.linage_length = LINAGE_LENGTH;
+
+    // accessions sorted by name with their linages and lengths
+    std::vector<std::string> accessions;
+    accessions.reserve(slimm_db.ac__taxid.size());
+    for (auto const & ac__taxid : slimm_db.ac__taxid)
+        accessions.push_back(ac__taxid.first);
+    std::sort(accessions.begin(), accessions.end());
+
+    std::vector<uint64_t>   accession_offsets(1, 0);
+    std::string             accession_pool;
+    std::vector<uint32_t>   linages;
+    std::vector<uint32_t>   accession_lengths;
+    linages.reserve(accessions.size() * LINAGE_LENGTH);
+    for (auto const & accession : accessions)
+    {
+        accession_pool += accession;
+        accession_offsets.push_back(accession_pool.size());
+        std::vector<uint32_t> const & linage = slimm_db.ac__taxid.at(accession);
+        for (uint32_t i = 0; i < LINAGE_LENGTH; ++i)
+            linages.push_back(i < linage.size() ? linage[i] : 0);
+        auto len_pos = slimm_db.ac__length.find(accession);
+        accession_lengths.push_back(len_pos == slimm_db.ac__length.end() ? 0 : len_pos->second);
+    }
+
+    // taxa are already sorted by id with their ranks and interned names
+    std::vector<uint32_t> const &   taxids = slimm_db.taxids;
+    std::vector<uint8_t> const &    taxon_ranks = slimm_db.taxon_ranks;
+    std::string const &             name_pool = slimm_db.names;
+    std::vector<uint64_t>           name_offsets(slimm_db.name_offsets.begin(), slimm_db.name_offsets.end());
+    if (name_offsets.empty())
+        name_offsets.push_back(0);
+    std::vector<uint32_t>           genome_lengths(slimm_db.genome_lengths);
+    genome_lengths.resize(taxids.size(), 0);
+
+    // reference names of known accessions sorted by name
+    std::vector<std::pair<std::string, uint32_t> > ref_names;
+    for (auto const & ref_name__ac : slimm_db.ref_name__ac)
+    {
+        auto ac_pos = std::lower_bound(accessions.begin(), accessions.end(), ref_name__ac.second);
+        if (ac_pos != accessions.end() && *ac_pos == ref_name__ac.second)
+            ref_names.push_back(std::make_pair(ref_name__ac.first, uint32_t(ac_pos - accessions.begin())));
+    }
+    std::sort(ref_names.begin(), ref_names.end());
+
+    std::vector<uint64_t>   ref_name_offsets(1, 0);
+    std::string             ref_name_pool;
+    std::vector<uint32_t>   ref_name_accessions;
+    for (auto const & ref_name : ref_names)
+    {
+        ref_name_pool += ref_name.first;
+        ref_name_offsets.push_back(ref_name_pool.size());
+        ref_name_accessions.push_back(ref_name.second);
+    }
+
+    header.accession_count  = accessions.size();
+    header.taxon_count      = taxids.size();
+    header.ref_name_count   = ref_names.size();
+
+    std::vector<char> image(sizeof(db_image_header), 0);
+    header.accession_offsets    = append_image_section(image, accession_offsets.data(), accession_offsets.size());
+    header.accession_pool       = append_image_section(image, accession_pool.data(), accession_pool.size());
+    header.linages              = append_image_section(image, linages.data(), linages.size());
+    header.accession_lengths    = append_image_section(image, accession_lengths.data(), accession_lengths.size());
+    header.taxids               = append_image_section(image, taxids.data(), taxids.size());
+    header.taxon_ranks          = append_image_section(image, taxon_ranks.data(), taxon_ranks.size());
+    header.name_offsets         = append_image_section(image, name_offsets.data(), name_offsets.size());
+    header.name_pool            = append_image_section(image, name_pool.data(), name_pool.size());
+    header.genome_lengths       = append_image_section(image, genome_lengths.data(), genome_lengths.size());
+    header.ref_name_offsets     = append_image_section(image, ref_name_offsets.data(), ref_name_offsets.size());
+    header.ref_name_pool        = append_image_section(image, ref_name_pool.data(), ref_name_pool.size());
+    header.ref_name_accessions  = append_image_section(image, ref_name_accessions.data(), ref_name_accessions.size());
+    image.resize((image.size() + 7) & ~size_t(7), 0);
+    header.size = image.size();
+    std::memcpy(header.magic, SLIMM_DB_IMAGE_MAGIC, sizeof(header.magic));
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    // keep the image in 8-byte words so that all the sections are aligned
+    _private_image.assign(image.size() / sizeof(uint64_t), 0);
+    std::memcpy(_private_image.data(), image.data(), image.size());
+    _set_header(reinterpret_cast<db_image_header const *>(_private_image.data()));
+}
+
+#ifndef _WIN32
+// --------------------------------------------------------------------------
+// Function open_image_segment()
+// --------------------------------------------------------------------------
+// names containing a '/' are treated as file paths (e.g. on a hugetlbfs
+// mount), others as POSIX shared memory segments.
+inline int open_image_segment(std::string const & segment_name, int flags)
+{
+    if (segment_name.find('/') != std::string::npos)
+        return ::open(segment_name.c_str(), flags, 0644);
+    return shm_open(("/" + segment_name).c_str(), flags, 0644);
+}
+
+// --------------------------------------------------------------------------
+// Function db_image::attach()
+// --------------------------------------------------------------------------
+inline bool db_image::attach(std::string const & segment_name)
+{
+    int fd = open_image_segment(segment_name, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(db_image_header))
+    {
+        ::close(fd);
+        return false;
+    }
+    void * address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+        return false;
+
+    db_image_header const * header = reinterpret_cast<db_image_header const *>(address);
+    // the magic is written last by publish(). a segment without it is incomplete
+    if (std::memcmp(header->magic, SLIMM_DB_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SLIMM_DB_IMAGE_VERSION ||
+        header->linage_length != LINAGE_LENGTH ||
+        header->size > static_cast<uint64_t>(st.st_size))
+    {
+        munmap(address, st.st_size);
+        return false;
+    }
+
+    _unmap();
+    std::vector<uint64_t>().swap(_private_image);
+    _mapped_address = address;
+    _mapped_size = st.st_size;
+    _set_header(header);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function db_image::publish()
+// --------------------------------------------------------------------------
+inline bool db_image::publish(std::string const & segment_name) const
+{
+    if (_header == nullptr)
+        return false;
+
+    int fd = open_image_segment(segment_name, O_RDWR | O_CREAT | O_EXCL);
+    if (fd == -1)
+        return false;
+
+    // hugetlbfs only accepts multiples of the huge page size
+    struct stat st;
+    size_t block_size = (fstat(fd, &st) == 0 && st.st_blksize > 0) ? st.st_blksize : 4096;
+    size_t segment_size = ((_header->size + block_size - 1) / block_size) * block_size;
+
+    if (ftruncate(fd, segment_size) == -1)
+    {
+        ::close(fd);
+        remove(segment_name);
+        return false;
+    }
+    void * address = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        remove(segment_name);
+        return false;
+    }
+
+    char * dest = static_cast<char *>(address);
+    char const * src = reinterpret_cast<char const *>(_header);
+    std::memcpy(dest + sizeof(_header->magic), src + sizeof(_header->magic), _header->size - sizeof(_header->magic));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(dest, src, sizeof(_header->magic));
+    munmap(address, segment_size);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function db_image::remove()
+// --------------------------------------------------------------------------
+inline bool db_image::remove(std::string const & segment_name)
+{
+    if (segment_name.find('/') != std::string::npos)
+        return unlink(segment_name.c_str()) == 0;
+    return shm_unlink(("/" + segment_name).c_str()) == 0;
+}
+
+#else
+inline bool db_image::attach(std::string const &)
+{
+    return false;
+}
+
+inline bool db_image::publish(std::string const &) const
+{
+    std::cerr << "Shared memory databases are not supported on this platform.\n";
+    return false;
+}
+
+inline bool db_image::remove(std::string const &)
+{
+    return false;
+}
+#endif
+
+#endif /* SHARED_DATABASE_H */
@@ -38,17 +38,31 @@
 #include <seqan/sequence.h>
 #include <seqan/arg_parse.h>
 #include <seqan/seq_io.h>
+#include <seqan/parallel.h>
 
 #include <string>
+#include <thread>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
 #include <unordered_map>
 
 #include "timer.hpp"
+#include "buffered_writer.hpp"
+#include "bgzf_writer.hpp"
 #include "misc.hpp"
 #include "file_helper.hpp"
 #include "reference_contig.hpp"
 #include "read_stat.hpp"
+#include "partial_state.hpp"
+#include "shared_database.hpp"
+#include "em_abundance.hpp"
+#include "libslimm.hpp"
+#include "slimm_serve.hpp"
 
 #include "slimm.hpp"
 
@@ -76,14 +90,16 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     // The output file argument.
     addOption(parser, ArgParseOption("o", "output-prefix", "output path prefix.", ArgParseArgument::OUTPUT_PREFIX));
 
-    addOption(parser, ArgParseOption("w", "bin-width", "Set the width of a single bin in neuclotides.",
+    addOption(parser, ArgParseOption("w", "bin-width", "Set the width of a single bin in neuclotides. "
+                                     "With --from-state any multiple of the saved bin width.",
                                      ArgParseArgument::INTEGER, "INT"));
     addOption(parser, ArgParseOption("mr", "min-reads", "Minimum number of matching reads to consider a reference present.",
                                      ArgParseArgument::INTEGER, "INT"));
 
-    addOption(parser, ArgParseOption("r", "rank", "The taxonomic rank of identification", ArgParseOption::STRING));
+    addOption(parser, ArgParseOption("r", "rank", "The taxonomic rank of identification. Repeat it (or use all) "
+                                     "to get a profile per rank from a single run.", ArgParseOption::STRING, "STR", true));
     setValidValues(parser, "rank", options.rankList);
-    setDefaultValue(parser, "rank", options.rank);
+    setDefaultValue(parser, "rank", options.ranks[0]);
 
     setDefaultValue(parser, "bin-width", options.bin_width);
     setDefaultValue(parser, "min-reads", options.min_reads);
@@ -102,6 +118,58 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setDefaultValue(parser, "abundance-cut-off", options.abundance_cut_off);
 
 
+    addOption(parser, ArgParseOption("sm", "shared-memory", "Attach to the database published by slimm_shm under this "
+                                     "name. DB is loaded privately if there is no such shared database.",
+                                     ArgParseArgument::STRING, "NAME"));
+
+    addOption(parser, ArgParseOption("em", "em", "Redistribute multi-mapping reads among the references that passed "
+                                     "the filters by expectation-maximization instead of assigning them to their LCA."));
+
+    addOption(parser, ArgParseOption("et", "em-tolerance", "Stop the EM once no abundance changes by more than this.",
+                                     ArgParseArgument::DOUBLE, "DOUBLE"));
+    setMinValue(parser, "em-tolerance", "0.0");
+    setDefaultValue(parser, "em-tolerance", options.em_tolerance);
+
+    addOption(parser, ArgParseOption("ei", "em-max-iterations", "Maximum number of EM iterations.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "em-max-iterations", "1");
+    setDefaultValue(parser, "em-max-iterations", options.em_max_iterations);
+
+    addOption(parser, ArgParseOption("dl", "db-genome-lengths", "Compute the coverage of a taxon over the average "
+                                     "length of all its references in DB (slimm_build --ref-metadata) instead of "
+                                     "those with reads in the sample. Changes which taxa pass --cov-cut-off."));
+
+    addOption(parser, ArgParseOption("t", "threads", "Specify the number of threads to use.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    setDefaultValue(parser, "threads", options.threads_count);
+
+    addOption(parser, ArgParseOption("b", "bootstrap", "Resample the reads of the sample this many times and add 95% "
+                                     "confidence intervals of the abundances to the profiles.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "bootstrap", "0");
+    setDefaultValue(parser, "bootstrap", options.bootstrap_count);
+
+    addOption(parser, ArgParseOption("sw", "sweep", "Profile the sample with every combination of the given values. "
+                                     "NAME is one of cc (cov-cut-off), ac (abundance-cut-off) or w (bin-width). "
+                                     "The alignments are read once, at the greatest common divisor of the bin widths. "
+                                     "Memory: the ingested sample, a coarsened copy of it per other bin width and the "
+                                     "references of one sample per --sweep-workers.",
+                                     ArgParseArgument::STRING, "NAME=V1,V2,...", true));
+    addOption(parser, ArgParseOption("swt", "sweep-workers", "The most --sweep combinations profiled at once. "
+                                     "Number of threads if 0.", ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "sweep-workers", "0");
+    setDefaultValue(parser, "sweep-workers", options.sweep_workers);
+
+    addOption(parser, ArgParseOption("ss", "save-state", "Save the state of each sample after reading its alignments "
+                                     "(PREFIX.slst) to profile it again with --from-state."));
+
+    addOption(parser, ArgParseOption("fs", "from-state", "IN is a state saved by --save-state instead of a SAM/BAM file. "
+                                     "Only the filtering, the LCA/EM and the reports are run."));
+
+    addOption(parser, ArgParseOption("j", "joint", "Profile the files of the input directory jointly: the references "
+                                     "are selected on the coverage pooled over all samples. All samples are held in memory."));
+
     addOption(parser,
               ArgParseOption("d", "directory", "Input is a directory."));
     addOption(parser,
@@ -109,6 +177,15 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
 
     addOption(parser,
               ArgParseOption("co", "coverage-output", "Output raw coverage statstics"));
+    addOption(parser, ArgParseOption("cf", "coverage-format", "Format of --coverage-output. bgzf writes the tracks "
+                                     "as BGZF compressed uint32 bins with a tsv index of the offset of each reference.",
+                                     ArgParseArgument::STRING, "STR"));
+    setValidValues(parser, "coverage-format", options.coverageFormatList);
+    setDefaultValue(parser, "coverage-format", options.coverage_format);
+
+    addOption(parser, ArgParseOption("rd", "read-output", "Write the taxon every read was assigned to (PREFIX_reads.tsv). "
+                                     "bgzf compresses it (PREFIX_reads.tsv.gz).", ArgParseArgument::STRING, "STR"));
+    setValidValues(parser, "read-output", options.readOutputList);
 
     addOption(parser,
               ArgParseOption("v", "verbose", "Enable verbose output."));
@@ -128,6 +205,55 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
                 "get taxonomic profiles from individual SAM/BAM files "
                 "located under \"\\fIexample-dir/\\fP\" and write them to tsv files "
                 "under \"\\fIslimm_reports/\\fP\" directory with their corsponding file names.");
+
+    addListItem(parser,
+                "\\fBslimm\\fP \\fB-fs\\fP \\fB-cc\\fP \\fI0.9\\fP \\fB-o\\fP "
+                "\\fIslimm_reports_cc90/\\fP \\fIslimm_db_5K.sldb\\fP \\fIslimm_reports/example.slst\\fP",
+                "profile \"\\fIexample.bam\\fP\" again with a different coverage cut-off "
+                "from the state saved by an earlier run with \\fB-ss\\fP.");
+
+    addListItem(parser,
+                "\\fBslimm map\\fP \\fIlane1.bam\\fP \\fIparts/lane1.slmp\\fP; "
+                "\\fBslimm reduce\\fP \\fB-o\\fP \\fIslimm_reports/example\\fP "
+                "\\fIslimm_db_5K.sldb\\fP \\fIparts/\\fP",
+                "map the lanes of a sample on any nodes, then merge their partial states "
+                "under \"\\fIparts/\\fP\" into one profile of the sample.");
+}
+
+// --------------------------------------------------------------------------
+// Function parse_sweep()
+// --------------------------------------------------------------------------
+// parse a --sweep value like cc=0.9,0.95 into the options
+bool parse_sweep(arg_options & options, std::string const & sweep)
+{
+    size_t eq_pos = sweep.find('=');
+    std::string name = sweep.substr(0, eq_pos);
+    if (eq_pos == std::string::npos || (name != "cc" && name != "ac" && name != "w"))
+    {
+        std::cerr << "slimm: Invalid --sweep " << sweep << ". Use cc=..., ac=... or w=...\n";
+        return false;
+    }
+
+    std::stringstream values(sweep.substr(eq_pos + 1));
+    std::string value;
+    while (std::getline(values, value, ','))
+    {
+        char * end = nullptr;
+        double number = std::strtod(value.c_str(), &end);
+        bool valid = !value.empty() && *end == '\0';
+        if (name == "cc" && valid && number >= 0.0 && number <= 1.0)
+            options.sweep_cov_cut_offs.push_back(number);
+        else if (name == "ac" && valid && number >= 0.0 && number <= 10.0)
+            options.sweep_abundance_cut_offs.push_back(number);
+        else if (name == "w" && valid && number >= 1.0 && number == uint32_t(number))
+            options.sweep_bin_widths.push_back(number);
+        else
+        {
+            std::cerr << "slimm: Invalid value " << value << " in --sweep " << sweep << ".\n";
+            return false;
+        }
+    }
+    return true;
 }
 
 // --------------------------------------------------------------------------
@@ -149,7 +275,11 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
         getOptionValue(options.min_reads, parser, "min-reads");
 
     if (isSet(parser, "rank"))
-        getOptionValue(options.rank, parser, "rank");
+    {
+        options.ranks.resize(getOptionValueCount(parser, "rank"));
+        for (unsigned i = 0; i < options.ranks.size(); ++i)
+            getOptionValue(options.ranks[i], parser, "rank", i);
+    }
 
     if (isSet(parser, "cov-cut-off"))
         getOptionValue(options.cov_cut_off, parser, "cov-cut-off");
@@ -160,17 +290,96 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
     if (isSet(parser, "verbose"))
         getOptionValue(options.verbose, parser, "verbose");
 
+    if (isSet(parser, "shared-memory"))
+        getOptionValue(options.shared_memory_name, parser, "shared-memory");
+
+    if (isSet(parser, "em"))
+        options.em = true;
+
+    if (isSet(parser, "em-tolerance"))
+        getOptionValue(options.em_tolerance, parser, "em-tolerance");
+
+    if (isSet(parser, "em-max-iterations"))
+        getOptionValue(options.em_max_iterations, parser, "em-max-iterations");
+
+    if (isSet(parser, "db-genome-lengths"))
+        options.db_genome_lengths = true;
+
+    if (isSet(parser, "bootstrap"))
+        getOptionValue(options.bootstrap_count, parser, "bootstrap");
+
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads_count, parser, "threads");
+
+    if (isSet(parser, "save-state"))
+        options.save_state = true;
+
+    if (isSet(parser, "from-state"))
+        options.from_state = true;
+
+    if (isSet(parser, "sweep-workers"))
+        getOptionValue(options.sweep_workers, parser, "sweep-workers");
+
+    for (unsigned i = 0; i < getOptionValueCount(parser, "sweep"); ++i)
+    {
+        std::string sweep;
+        getOptionValue(sweep, parser, "sweep", i);
+        if (!parse_sweep(options, sweep))
+            return ArgumentParser::PARSE_ERROR;
+    }
+
+    if (options.save_state && options.from_state)
+    {
+        std::cerr << "slimm: --save-state and --from-state can not be used together.\n";
+        return ArgumentParser::PARSE_ERROR;
+    }
+
     if (isSet(parser, "directory"))
         options.is_directory = true;
 
+    if (isSet(parser, "joint"))
+        options.joint = true;
+
+    if (options.joint && (!options.is_directory || !options.sweep_bin_widths.empty() ||
+                          !options.sweep_cov_cut_offs.empty() || !options.sweep_abundance_cut_offs.empty()))
+    {
+        std::cerr << "slimm: --joint needs a directory as input and can not be combined with --sweep.\n";
+        return ArgumentParser::PARSE_ERROR;
+    }
+
     if (isSet(parser, "raw-output"))
         options.raw_output = true;
 
     if (isSet(parser, "coverage-output"))
         options.coverage_output = true;
 
+    if (isSet(parser, "coverage-format"))
+        getOptionValue(options.coverage_format, parser, "coverage-format");
+
+    if (isSet(parser, "read-output"))
+        getOptionValue(options.read_output, parser, "read-output");
+
+    // the read names are neither saved in a state nor copied to sweep workers
+    if (!options.read_output.empty() && (options.from_state || !options.sweep_bin_widths.empty() ||
+        !options.sweep_cov_cut_offs.empty() || !options.sweep_abundance_cut_offs.empty()))
+    {
+        std::cerr << "slimm: --read-output can not be combined with --from-state or --sweep.\n";
+        return ArgumentParser::PARSE_ERROR;
+    }
+
+    // the reads are hashed in the partial states, there is a single sample
+    if (options.from_partials && (options.is_directory || options.from_state || !options.read_output.empty()))
+    {
+        std::cerr << "slimm reduce: IN is a directory of partial states. --directory, --joint, --from-state "
+                     "and --read-output can not be used.\n";
+        return ArgumentParser::PARSE_ERROR;
+    }
+
     getArgumentValue(options.database_path, parser, 0);
     getArgumentValue(options.input_path, parser, 1);
+    // the reports of slimm reduce are named after the directory
+    while (options.from_partials && options.input_path.size() > 1 && options.input_path.back() == '/')
+        options.input_path.pop_back();
 
     getOptionValue(options.output_prefix, parser, "output-prefix");
     if (!isSet(parser, "output-prefix"))
@@ -179,6 +388,163 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
     return ArgumentParser::PARSE_OK;
 }
 
+// --------------------------------------------------------------------------
+// Function run_serve_job()
+// --------------------------------------------------------------------------
+// a job of slimm serve: the arguments of a slimm run without DB. the job
+// borrows the database of the server.
+std::string run_serve_job(std::vector<std::string> const & args, slimm const & server, uint32_t job_threads)
+{
+    std::vector<char const *> argv = {"slimm", server.options.database_path.c_str()};
+    for (auto const & arg : args)
+        argv.push_back(arg.c_str());
+
+    ArgumentParser parser;
+    arg_options options;
+    options.threads_count = job_threads;
+    setupArgumentParser(parser, options);
+    ArgumentParser::ParseResult res = parseCommandLine(parser, options, argv.size(), argv.data());
+    if (res != ArgumentParser::PARSE_OK)
+        return "ERROR invalid arguments, see the log of the server\n";
+    // a missing input must not reach the readers
+    if (options.is_directory && !is_directory(toCString(options.input_path)))
+        return "ERROR " + options.input_path + " is not a directory\n";
+    if (!options.is_directory && !is_file(toCString(options.input_path)))
+        return "ERROR " + options.input_path + " is not a file\n";
+
+#ifdef _OPENMP
+    omp_set_num_threads(options.threads_count);
+#endif
+
+    std::ostringstream reply;
+    try
+    {
+        Timer<> stop_watch;
+        slimm job(options, server.db);
+        job.quiet = true;
+        uint32_t hits_count = profile_files(job);
+        // inputs that could not be read and reports that could not be written
+        if (job.failures.empty())
+        {
+            reply << "OK " << hits_count << " " << stop_watch.elapsed() << "\n";
+        }
+        else
+        {
+            reply << "ERROR " << job.failures.size() << " failed:";
+            for (auto const & failure : job.failures)
+                reply << " " << failure << ";";
+            reply << "\n";
+        }
+    }
+    catch (std::exception const & e)
+    {
+        reply << "ERROR " << e.what() << "\n";
+    }
+    if (server.options.verbose)
+        std::cerr << options.input_path << ": " << reply.str();
+    return reply.str();
+}
+
+// --------------------------------------------------------------------------
+// Function serve_main()
+// --------------------------------------------------------------------------
+// slimm serve: load the database once and run the jobs sent to a socket
+int serve_main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    setAppName(parser, "slimm serve");
+    setShortDescription(parser, "runs slimm jobs sent to a Unix-domain socket");
+    setCategory(parser, "Metagenomics");
+    setDateAndVersion(parser);
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIDB\\fP\" \"\\fISOCKET\\fP\"");
+    addDescription(parser, "Loads DB once and listens on SOCKET. A job is one line with the tab separated arguments "
+                           "of a slimm run without DB, e.g. \"-o<TAB>out/prefix<TAB>sample.bam\". It is answered "
+                           "with \"OK <records> <secs>\" or \"ERROR <message>\". The line \"shutdown\" stops the server.");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "DB"));
+    setValidValues(parser, 0, ".sldb");
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SOCKET"));
+
+    uint32_t jobs_count = 2;
+    uint32_t job_threads = std::max(std::thread::hardware_concurrency() / jobs_count, 1u);
+    addOption(parser, ArgParseOption("j", "jobs", "Number of jobs run at the same time.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "jobs", "1");
+    setDefaultValue(parser, "jobs", jobs_count);
+    addOption(parser, ArgParseOption("t", "threads", "Default number of threads of a job. "
+                                     "Hardware threads / jobs if not given.", ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    addOption(parser, ArgParseOption("sm", "shared-memory", "Attach to the database published by slimm_shm under this "
+                                     "name. DB is loaded privately if there is no such shared database.",
+                                     ArgParseArgument::STRING, "NAME"));
+    addOption(parser, ArgParseOption("v", "verbose", "Log every job."));
+
+    if (parse(parser, argc, argv) != ArgumentParser::PARSE_OK)
+        return 1;
+
+    arg_options options;
+    std::string socket_path;
+    getArgumentValue(options.database_path, parser, 0);
+    getArgumentValue(socket_path, parser, 1);
+    getOptionValue(jobs_count, parser, "jobs");
+    job_threads = std::max(std::thread::hardware_concurrency() / jobs_count, 1u);
+    if (isSet(parser, "threads"))
+        getOptionValue(job_threads, parser, "threads");
+    if (isSet(parser, "shared-memory"))
+        getOptionValue(options.shared_memory_name, parser, "shared-memory");
+    options.verbose = isSet(parser, "verbose");
+
+    Timer<> stop_watch;
+    slimm server(options);
+    std::cerr << "Database loaded in " << stop_watch.lap() << " secs. Listening on " << socket_path
+              << " with " << jobs_count << " job slots.\n";
+
+    job_server jobs(socket_path, jobs_count, [&](std::vector<std::string> const & args)
+    {
+        return run_serve_job(args, server, job_threads);
+    });
+    return jobs.serve() ? 0 : 1;
+}
+
+// --------------------------------------------------------------------------
+// Function map_main()
+// --------------------------------------------------------------------------
+// slimm map: write the partial state of one shard of a sample for slimm reduce
+int map_main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    setAppName(parser, "slimm map");
+    setShortDescription(parser, "reads a shard of a sample into a partial state for slimm reduce");
+    setCategory(parser, "Metagenomics");
+    setDateAndVersion(parser);
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIIN\\fP\" \"\\fIOUT\\fP\"");
+    addDescription(parser, "Groups the mapped records of the SAM/BAM file IN by read and writes them to OUT. "
+                           "slimm reduce merges the partial states of all shards (e.g. lanes) of a sample in a "
+                           "directory into the profile of their concatenation. No database is needed.");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "IN"));
+    setValidValues(parser, 0, BamFileIn::getFileExtensions());
+    addArgument(parser, ArgParseArgument(ArgParseArgument::OUTPUT_FILE, "OUT"));
+    setValidValues(parser, 1, ".slmp");
+    addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
+
+    if (parse(parser, argc, argv) != ArgumentParser::PARSE_OK)
+        return 1;
+
+    std::string bam_path, partial_path;
+    getArgumentValue(bam_path, parser, 0);
+    getArgumentValue(partial_path, parser, 1);
+
+    Timer<> stop_watch;
+    partial_state partial;
+    if (!partial.map_alignments(bam_path) || !partial.save(partial_path))
+        return 1;
+    if (isSet(parser, "verbose"))
+        std::cerr << partial.hits_count << " hits of " << partial.read_keys.size() << " reads written to "
+                  << partial_path << " in " << stop_watch.elapsed() << " secs.\n";
+    return 0;
+}
+
 // --------------------------------------------------------------------------
 // Function main()
 // --------------------------------------------------------------------------
@@ -186,11 +552,26 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
 // Program entry point.
 int main(int argc, char const ** argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "serve")
+        return serve_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "map")
+        return map_main(argc - 1, argv + 1);
+
     // Parse the command line.
     ArgumentParser parser;
     arg_options options;
     setupArgumentParser(parser, options);
 
+    // slimm reduce takes the options of a slimm run, IN is a directory of partial states
+    if (argc > 1 && std::string(argv[1]) == "reduce")
+    {
+        setAppName(parser, "slimm reduce");
+        setShortDescription(parser, "profiles a sample from the partial states written by slimm map");
+        options.from_partials = true;
+        --argc;
+        ++argv;
+    }
+
     ArgumentParser::ParseResult res = parseCommandLine(parser, options, argc, argv);
 
     // If there was an error parsing or built-in argument parser functionality
@@ -200,5 +581,17 @@ int main(int argc, char const ** argv)
     if (res != ArgumentParser::PARSE_OK)
         return res == ArgumentParser::PARSE_ERROR;
 
-    return get_taxonomic_profile(options);
+#ifdef _OPENMP
+    omp_set_num_threads(options.threads_count);
+#endif
+
+    try
+    {
+        return get_taxonomic_profile(options);
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "[ERROR!] " << e.what() << "\n";
+        return 1;
+    }
 }
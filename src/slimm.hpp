@@ -50,40 +50,133 @@ struct arg_options
 {
     typedef std::vector<std::string>            TList;
 
-    TList rankList = {"strains",
+    TList coverageFormatList = {"csv", "bgzf"};
+    TList readOutputList = {"tsv", "bgzf"};
+
+    TList rankList = {"strain",
                       "species",
                       "genus",
                       "family",
                       "order",
                       "class",
                       "phylum",
-                      "superkingdom"};
+                      "superkingdom",
+                      "all"};
 
     float               cov_cut_off;
     float               abundance_cut_off;
     uint32_t            bin_width;
     uint32_t            min_reads;
+    uint32_t            threads_count;
+    // the most --sweep combinations profiled at once, 0 for threads_count
+    uint32_t            sweep_workers;
+    uint32_t            em_max_iterations;
+    uint32_t            bootstrap_count;
+    double              em_tolerance;
+    bool                em;
+    // coverage over the genome lengths stored in the database (--db-genome-lengths)
+    bool                db_genome_lengths;
+    bool                joint;
+    bool                save_state;
+    bool                from_state;
+    // slimm reduce: input_path is a directory of partial states of one sample
+    bool                from_partials;
     bool                verbose;
     bool                is_directory;
     bool                raw_output;
     bool                coverage_output;
-    std::string         rank;
+    TList               ranks;
+    std::string         coverage_format;
+    // the per-read assignments are written if set to tsv or bgzf
+    std::string         read_output;
     std::string         input_path;
     std::string         output_prefix;
     std::string         database_path;
+    std::string         shared_memory_name;
+    // added to the names of the reports, e.g. to tell sweep combinations apart
+    std::string         output_tag;
+    std::vector<float>      sweep_cov_cut_offs;
+    std::vector<float>      sweep_abundance_cut_offs;
+    std::vector<uint32_t>   sweep_bin_widths;
 
     arg_options() : cov_cut_off(0.95),
                     abundance_cut_off(0.01),
                     bin_width(0),
                     min_reads(0),
+                    threads_count(std::thread::hardware_concurrency()),
+                    sweep_workers(0),
+                    em_max_iterations(1000),
+                    bootstrap_count(0),
+                    em_tolerance(1e-7),
+                    em(false),
+                    db_genome_lengths(false),
+                    joint(false),
+                    save_state(false),
+                    from_state(false),
+                    from_partials(false),
                     verbose(false),
                     is_directory(false),
                     raw_output(false),
                     coverage_output(false),
-                    rank("species"),
+                    ranks({"species"}),
+                    coverage_format("csv"),
+                    read_output(""),
                     input_path(""),
                     output_prefix(""),
-                    database_path("") {}
+                    database_path(""),
+                    shared_memory_name(""),
+                    output_tag("") {}
+};
+
+// written at the start of every saved sample state followed by the format version
+char const      SLIMM_STATE_MAGIC[8]        = {'S', 'L', 'I', 'M', 'M', 'S', 'T', '\0'};
+uint32_t const  SLIMM_STATE_FORMAT_VERSION  = 1;
+// a sweep reads the sample at most this many times finer than its finest width
+uint32_t const  SWEEP_MAX_REFINEMENT        = 8;
+
+// ----------------------------------------------------------------------------
+// Class reference_cache
+// ----------------------------------------------------------------------------
+// the accessions and linages of the contigs of a SAM/BAM header. samples
+// mapped against the same references look them up in the database once.
+class reference_cache
+{
+public:
+    // get the accessions and linages if contig_names are the cached ones
+    inline bool get(StringSet<CharString> const & contig_names,
+                    std::vector<std::string> & accessions,
+                    std::vector<TLinage> & linages)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_contig_names.size() != length(contig_names))
+            return false;
+        for (uint32_t i=0; i < _contig_names.size(); ++i)
+            if (_contig_names[i] != toCString(contig_names[i]))
+                return false;
+        accessions = _accessions;
+        linages = _linages;
+        return true;
+    }
+
+    // the first header cached is kept
+    inline void put(StringSet<CharString> const & contig_names,
+                    std::vector<std::string> const & accessions,
+                    std::vector<TLinage> const & linages)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_contig_names.empty())
+            return;
+        for (uint32_t i=0; i < length(contig_names); ++i)
+            _contig_names.push_back(toCString(contig_names[i]));
+        _accessions = accessions;
+        _linages = linages;
+    }
+
+private:
+    std::mutex                  _mutex;
+    std::vector<std::string>    _contig_names;
+    std::vector<std::string>    _accessions;
+    std::vector<TLinage>        _linages;
 };
 
 // ----------------------------------------------------------------------------
@@ -93,11 +186,34 @@ class slimm
 {
 public:
     //constructor with argument options
-    slimm(arg_options op): options(op)
+    slimm(arg_options op): options(op), _own_db(new db_image()), db(*_own_db),
+                           _requested_bin_width(op.bin_width)
     {
         collect_bam_files();
         get_considered_ranks();
-        load_slimm_database(db, options.database_path);
+        load_database();
+    }
+
+    ~slimm()
+    {
+        wait_for_reports();
+    }
+
+    // use a database loaded by someone else
+    slimm(arg_options op, db_image const & database): options(op), db(database),
+                                                       _requested_bin_width(op.bin_width)
+    {
+        collect_bam_files();
+        get_considered_ranks();
+    }
+
+    // a worker for a single input path resolved by someone else, e.g. a file
+    // of a directory. the input is not looked up again.
+    slimm(arg_options op, db_image const & database, std::string const & input_path):
+          options(op), number_of_files(1), db(database), _requested_bin_width(op.bin_width),
+          _input_paths(1, input_path)
+    {
+        get_considered_ranks();
     }
 
     arg_options                                         options;
@@ -118,25 +234,87 @@ public:
     uint32_t                    uniq_matches_count2       = 0;
 
 
-    slimm_database                                      db;
+private:
+    // set if the database was loaded by this instance
+    std::unique_ptr<db_image>                           _own_db;
+public:
+    db_image const &                                    db;
+    // suppress the progress messages
+    bool                                                quiet = false;
+    // write the reports on a background thread, see write_reports_async()
+    bool                                                async_reports = false;
+    // valid_ref_ids were chosen jointly with other samples
+    bool                                                preset_references = false;
+    // contig lookups shared with other samples
+    std::shared_ptr<reference_cache>                    shared_references;
+    // the inputs that could not be read and the reports that could not be
+    // written, see add_failure()
+    std::vector<std::string>                            failures;
     std::set<uint32_t>                                  valid_ref_ids;
     std::vector<taxa_ranks>                             considered_ranks;
     std::vector<reference_contig>                       references;
-    std::unordered_map<std::string, read_stat>          reads;
-    std::unordered_map<uint32_t, uint32_t>              taxon_id__read_count;
-    std::unordered_map<uint32_t, std::set<uint32_t> >   taxon_id__children;
+    read_table                                          reads;
+    std::vector<read_class>                             read_classes;
+    // the read classes of another sample filter_alignments() reads instead
+    // of read_classes, see sweep_profiles()
+    std::vector<read_class> const *                     shared_read_classes = nullptr;
+    // for --read-output: the names of the reads ('\0' separated) and their classes
+    std::string                                         read_names;
+    std::vector<uint32_t>                               read_name_classes;
+    // the taxa in the linages of the references (sorted) and their stats
+    std::vector<uint32_t>                               taxon_ids;
+    std::vector<taxon_stat>                             taxa;
+    // the LCA of every read class (dense, or NOT_FOUND for unique classes),
+    // the reference whose linage an LCA passes its reads up and the dense
+    // linages of the references
+    std::vector<uint32_t>                               class_lcas;
+    std::vector<uint32_t>                               lca_first_child;
+    std::vector<TLinage>                                dense_linages;
+    // the taxon read counts and matching reads of every bootstrap replicate
+    std::vector<std::vector<uint32_t> >                 replicate_taxon_counts;
+    std::vector<uint32_t>                               replicate_matches_counts;
 
     inline std::string current_bam_file_path()
     {
         return _input_paths[current_file_index];
     }
 
+    inline bool     ingest_sample(Timer<> & stop_watch);
+    inline void     add_failure(std::string const & message);
+    inline void     add_failures(slimm const & other);
+    inline void     profile_sample(Timer<> & stop_watch);
+    inline void     copy_sample(slimm const & other, bool with_read_classes = true);
+    inline void     copy_settings(slimm const & other);
+    inline bool     coarsen_sample(uint32_t bin_width);
+    inline void     sweep_profiles();
+    template <typename TLengths>
+    inline void     init_references(StringSet<CharString> const & contig_names, TLengths const & contig_lengths);
+    inline void     add_hit(std::string const & read_key, uint32_t ref_id, uint32_t begin_pos);
+    inline uint32_t get_bin_number(uint32_t ref_id, uint32_t begin_pos) const;
+    inline void     finish_ingest();
+    inline void     compute_profile(std::ostream & log_stream, Timer<> & stop_watch);
+    inline void     write_reports(std::ostream & log_stream, Timer<> & stop_watch);
+    inline void     write_reports_async();
+    inline void     wait_for_reports();
+    inline void     joint_profiles();
+    inline uint32_t task_profiles();
+    inline void     select_references();
+    inline bool     read_alignments(Timer<> & stop_watch);
+    inline bool     read_partials(Timer<> & stop_watch);
     inline void     analyze_alignments(BamFileIn & bam_file);
+    inline void     compress_reads();
+    inline void     em_reassign_reads();
     inline float    coverage_cut_off();
     inline float    expected_coverage() const;
     inline void     filter_alignments();
     inline void     get_profiles();
     inline void     get_reads_lca_count();
+    inline void     bootstrap();
+    inline uint32_t get_ref_reads_counts(std::vector<uint32_t> & ref_counts,
+                                         std::vector<uint32_t> const & class_counts) const;
+    inline void     get_taxon_reads_counts(std::vector<uint32_t> & taxon_counts,
+                                           std::vector<uint32_t> const & ref_counts,
+                                           std::vector<uint32_t> const & class_counts) const;
     inline uint32_t min_reads();
     inline uint32_t min_uniq_reads();
     inline void     print_filter_stat();
@@ -144,10 +322,19 @@ public:
     inline float    uniq_coverage_cut_off();
     inline void     write_raw_stat();
     inline void     write_coverage();
-    inline void     write_abundance();
+    inline void     write_coverage_bgzf();
+    inline void     write_read_assignments();
+    template <typename TWriter>
+    inline bool     write_read_rows(TWriter & writer);
+    inline void     write_abundance(taxa_ranks rank);
+    inline uint32_t get_profile_rows(taxa_ranks rank, std::vector<slimm_profile_row> & rows);
+    inline std::vector<float> replicate_abundances(uint32_t taxon) const;
+    inline void     save_state();
+    inline bool     load_state(std::string const & state_path);
     inline void     reset();
     inline uint32_t get_lca(std::set<uint32_t> const & ref_ids);
-    inline std::string get_lineage_string(taxa_ranks rank, std::vector<uint32_t> const & linage);
+    inline uint32_t taxon_index(uint32_t taxa_id) const;
+    inline std::string get_lineage_string(taxa_ranks rank, TLinage const & linage);
     inline std::string get_lineage_string(taxa_ranks rank, uint32_t const & taxa_id);
 
 private:
@@ -156,11 +343,17 @@ private:
     float                       _uniq_coverage_cut_off  = 0.0;
     int32_t                     _min_uniq_reads         = -1;
     int32_t                     _min_reads              = -1;
+    uint32_t                    _requested_bin_width    = 0;
     std::vector<std::string>    _input_paths;
+    std::thread                 _report_thread;
+    std::unique_ptr<slimm>      _report_snapshot;
+    // failures are added by the report threads and parallel workers
+    std::mutex                  _failures_mutex;
 
     // member functions
     inline void collect_bam_files();
     inline void get_considered_ranks();
+    inline void load_database();
     inline void load_taxonomic_info();
 };
 
@@ -182,79 +375,107 @@ inline void slimm::reset()
     valid_ref_ids.clear();
     references.clear();
     reads.clear();
-    taxon_id__read_count.clear();
-    taxon_id__children.clear();
+    read_classes.clear();
+    read_names.clear();
+    read_name_classes.clear();
+    taxon_ids.clear();
+    taxa.clear();
+    replicate_taxon_counts.clear();
+    replicate_matches_counts.clear();
 
 }
 
 
+// the records are decoded in batches. the keys and bins of a batch are
+// computed in parallel chunks, then every shard of the read table is filled by
+// one task in record order, so the first hit of a read on a reference (the one
+// uniq_cov and the first bins of a class use) does not depend on the threads.
 inline void slimm::analyze_alignments(BamFileIn & bam_file)
 {
-    BamAlignmentRecord record;
+    uint32_t const batch_size = 1 << 16;
+    uint32_t const chunk_size = 1 << 12;
+    uint32_t const shards_count = reads.shards_count();
+    std::vector<BamAlignmentRecord> records(batch_size);
+    std::vector<std::string> read_keys(batch_size);
+    std::vector<uint32_t> bin_numbers(batch_size);
+    std::vector<uint32_t> record_shards(batch_size);
+    std::vector<uint32_t> shard_begins(shards_count + 1);
+    std::vector<uint32_t> shard_records(batch_size);
     while (!atEnd(bam_file))
     {
-        readRecord(record, bam_file);
-        if (hasFlagUnmapped(record) || record.rID == BamAlignmentRecord::INVALID_REFID)
-            continue;  // Skip these records.
-
-        uint32_t center_position =  std::min(record.beginPos + (avg_read_length/2), references[record.rID].length);
-        uint32_t relative_bin_no = center_position/options.bin_width;
-
-        // maintain read properties under slimm.reads
-        std::string read_name = toCString(record.qName);
-        if(hasFlagFirst(record))
-            append(read_name, ".1");
-        else if(hasFlagLast(record))
-            append(read_name, ".2");
-
-        // if there is no read with read_name this will create one.
-        reads[read_name].add_target(record.rID, relative_bin_no);
-        ++hits_count;
-    }
-
-
-    if (hits_count == 0)
-        return;
-
-    for (auto it= reads.begin(); it != reads.end(); ++it)
-    {
-        if(it->second.is_uniq())
+        uint32_t records_count = 0;
+        while (records_count < batch_size && !atEnd(bam_file))
         {
-            uint32_t reference_id = it->second.targets[0].reference_id;
-            it->second.refs_length_sum += references[reference_id].length;
-            ++uniq_matches_count;
+            BamAlignmentRecord & record = records[records_count];
+            readRecord(record, bam_file);
+            if (hasFlagUnmapped(record) || record.rID == BamAlignmentRecord::INVALID_REFID)
+                continue;  // Skip these records.
+            ++records_count;
+        }
+        hits_count += records_count;
 
-            size_t pos_count = (it->second.targets[0]).positions.size();
-            references[reference_id].reads_count += pos_count;
-            it->second.refs_length_sum += references[reference_id].length;
-            for (size_t j=0; j < pos_count; ++j)
+        parallel_for_tasks((records_count + chunk_size - 1) / chunk_size, [&](int64_t c)
+        {
+            uint32_t chunk_end = std::min(records_count, uint32_t(c + 1) * chunk_size);
+            for (uint32_t i = c * chunk_size; i < chunk_end; ++i)
             {
-                uint32_t bin_number = (it->second.targets[0]).positions[j];
-                ++references[reference_id].cov.bins_height[bin_number];
+                BamAlignmentRecord const & record = records[i];
+                // maintain read properties under slimm.reads
+                std::string & read_name = read_keys[i];
+                read_name = toCString(record.qName);
+                if(hasFlagFirst(record))
+                    append(read_name, ".1");
+                else if(hasFlagLast(record))
+                    append(read_name, ".2");
+                bin_numbers[i] = get_bin_number(record.rID, record.beginPos);
+                record_shards[i] = reads.shard_index(read_name);
             }
-            references[reference_id].uniq_reads_count += 1;
-            uniq_hits_count += 1;
-            ++references[reference_id].uniq_cov.bins_height[(it->second.targets[0]).positions[0]];
-        }
-        else
+        });
+
+        // a stable counting sort of the records by shard
+        std::fill(shard_begins.begin(), shard_begins.end(), 0);
+        for (uint32_t i = 0; i < records_count; ++i)
+            ++shard_begins[record_shards[i] + 1];
+        std::partial_sum(shard_begins.begin(), shard_begins.end(), shard_begins.begin());
+        std::vector<uint32_t> shard_ends(shard_begins.begin(), shard_begins.end() - 1);
+        for (uint32_t i = 0; i < records_count; ++i)
+            shard_records[shard_ends[record_shards[i]]++] = i;
+
+        parallel_for_tasks(shards_count, [&](int64_t s)
         {
-            size_t len = it->second.targets.size();
-            for (size_t i=0; i < len; ++i)
+            read_table::TShard & shard = reads.shard(s);
+            for (uint32_t k = shard_begins[s]; k < shard_begins[s + 1]; ++k)
             {
-
-                uint32_t reference_id = it->second.targets[i].reference_id;
-                it->second.refs_length_sum += references[reference_id].length;
-
-                // ***** all of the matches in multiple pos will be counted *****
-                references[reference_id].reads_count += (it->second.targets[i]).positions.size();
-                for (auto bin_number : (it->second.targets[i]).positions)
-                {
-                    ++references[reference_id].cov.bins_height[bin_number];
-                }
+                uint32_t i = shard_records[k];
+                shard[read_keys[i]].add_target(records[i].rID, bin_numbers[i]);
             }
-        }
+        });
     }
-    matches_count = reads.size();
+    finish_ingest();
+}
+
+// the coverage bin of a match that starts at begin_pos
+inline uint32_t slimm::get_bin_number(uint32_t ref_id, uint32_t begin_pos) const
+{
+    uint32_t center_position =  std::min(begin_pos + (avg_read_length/2), references[ref_id].length);
+    return center_position/options.bin_width;
+}
+
+// a match of the read read_key (a name or any other key unique to the read)
+// on the reference ref_id starting at begin_pos
+inline void slimm::add_hit(std::string const & read_key, uint32_t ref_id, uint32_t begin_pos)
+{
+    reads.add_target(read_key, ref_id, get_bin_number(ref_id, begin_pos));
+    ++hits_count;
+}
+
+// fold the reads into classes and compute the raw abundances once all hits are added
+inline void slimm::finish_ingest()
+{
+    if (hits_count == 0)
+        return;
+
+    compress_reads();
 
     float totalAb = 0.0;
     for (uint32_t i=0; i<length(references); ++i)
@@ -302,215 +523,1280 @@ inline void slimm::analyze_alignments(BamFileIn & bam_file)
     }
 }
 
-//collect the sam files to process
+// fold the positions of every read into the coverage of its references and
+// group the reads by their set of targets. the per-read table is freed.
+// the shards of the table are folded by tasks into partials that are merged
+// afterwards: the counters and bins reference by reference in parallel, the
+// classes in the order of the partials. the counts are integers and the
+// classes are sorted at the end, so the result does not depend on the threads.
+inline void slimm::compress_reads()
+{
+    uint32_t const partials_count = std::min(16u, reads.shards_count());
+    uint32_t const ref_count = length(references);
+    bool keep_read_names = !options.read_output.empty();
+    std::vector<read_partial> partials(partials_count);
+
+    parallel_for_tasks(partials_count, [&](int64_t p)
+    {
+        read_partial & partial = partials[p];
+        partial.reads_count.assign(ref_count, 0);
+        partial.uniq_reads_count.assign(ref_count, 0);
+        std::vector<uint32_t> target_set;
+        std::vector<uint32_t> first_bins;
+        for (uint32_t s=p; s < reads.shards_count(); s += partials_count)
+        for (auto it= reads.shard(s).begin(); it != reads.shard(s).end(); ++it)
+        {
+            std::vector<target_reference> & targets = it->second.targets;
+            if(targets.size() == 1)
+                ++partial.uniq_matches_count;
+            for (auto const & tr : targets)
+            {
+                // ***** all of the matches in multiple pos will be counted *****
+                partial.reads_count[tr.reference_id] += tr.positions.size();
+                bins_accumulator & bins = partial.cov_bins[tr.reference_id];
+                uint32_t bins_count = references[tr.reference_id].cov.bins_height.size();
+                for (auto bin_number : tr.positions)
+                    bins.add(bin_number, bins_count);
+            }
+            if(targets.size() == 1)
+            {
+                partial.uniq_reads_count[targets[0].reference_id] += 1;
+                partial.uniq_cov_bins[targets[0].reference_id].add(targets[0].positions[0],
+                        references[targets[0].reference_id].uniq_cov.bins_height.size());
+            }
+
+            // the first bins of a unique read are already in uniq_cov
+            std::sort(targets.begin(), targets.end(),
+                      [](target_reference const & a, target_reference const & b)
+                      { return a.reference_id < b.reference_id; });
+            target_set.clear();
+            first_bins.clear();
+            for (auto const & tr : targets)
+            {
+                target_set.push_back(tr.reference_id);
+                first_bins.push_back(tr.positions[0]);
+            }
+
+            auto found = partial.target_set__class.find(target_set);
+            if (found == partial.target_set__class.end())
+            {
+                found = partial.target_set__class.emplace(target_set, partial.classes.size()).first;
+                partial.classes.push_back(read_class());
+                partial.classes.back().targets = target_set;
+                if (target_set.size() > 1)
+                    partial.classes.back().first_bins.resize(target_set.size());
+            }
+            read_class & rc = partial.classes[found->second];
+            ++rc.count;
+            if (keep_read_names)
+            {
+                partial.read_names.append(it->first);
+                partial.read_names.push_back('\0');
+                partial.read_name_classes.push_back(found->second);
+            }
+            if (target_set.size() > 1)
+            {
+                for (size_t i=0; i < first_bins.size(); ++i)
+                    rc.first_bins[i].push_back(std::make_pair(first_bins[i], 1u));
+                // keep the pending bins of big classes in check
+                if (rc.first_bins[0].size() >= 1024 && (rc.count & (rc.count - 1)) == 0)
+                    rc.compact_bins();
+            }
+        }
+    });
+
+    // every reference is merged by a single task
+    uint32_t const refs_per_task = 1024;
+    parallel_for_tasks((ref_count + refs_per_task - 1) / refs_per_task, [&](int64_t c)
+    {
+        uint32_t refs_end = std::min(ref_count, uint32_t(c + 1) * refs_per_task);
+        for (uint32_t i = c * refs_per_task; i < refs_end; ++i)
+        {
+            reference_contig & ref = references[i];
+            for (auto const & partial : partials)
+            {
+                ref.reads_count += partial.reads_count[i];
+                ref.uniq_reads_count += partial.uniq_reads_count[i];
+                auto bins = partial.cov_bins.find(i);
+                if (bins != partial.cov_bins.end())
+                    bins->second.merge_into(ref.cov.bins_height);
+                bins = partial.uniq_cov_bins.find(i);
+                if (bins != partial.uniq_cov_bins.end())
+                    bins->second.merge_into(ref.uniq_cov.bins_height);
+            }
+        }
+    });
+
+    std::unordered_map<std::vector<uint32_t>, uint32_t, target_set_hash> target_set__class;
+    for (auto & partial : partials)
+    {
+        uniq_matches_count += partial.uniq_matches_count;
+        uniq_hits_count += partial.uniq_matches_count;
+
+        std::vector<uint32_t> partial_class_map(partial.classes.size());
+        for (uint32_t k=0; k < partial.classes.size(); ++k)
+        {
+            read_class & partial_class = partial.classes[k];
+            auto found = target_set__class.find(partial_class.targets);
+            if (found == target_set__class.end())
+            {
+                found = target_set__class.emplace(partial_class.targets, read_classes.size()).first;
+                read_classes.push_back(std::move(partial_class));
+            }
+            else
+            {
+                read_class & rc = read_classes[found->second];
+                rc.count += partial_class.count;
+                for (size_t i=0; i < rc.first_bins.size(); ++i)
+                    rc.first_bins[i].insert(rc.first_bins[i].end(), partial_class.first_bins[i].begin(),
+                                            partial_class.first_bins[i].end());
+            }
+            partial_class_map[k] = found->second;
+        }
+
+        if (keep_read_names)
+        {
+            read_names.append(partial.read_names);
+            for (auto class_id : partial.read_name_classes)
+                read_name_classes.push_back(partial_class_map[class_id]);
+        }
+        partial = read_partial();
+    }
+    matches_count = reads.size();
+    reads.clear();
+
+    // the order of the reads in the table depends on the threads that added
+    // them. classes sorted by their targets keep the bootstrap reproducible.
+    std::vector<uint32_t> order(read_classes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return read_classes[a].targets < read_classes[b].targets; });
+    std::vector<uint32_t> class_map(order.size());
+    std::vector<read_class> sorted_classes(order.size());
+    for (uint32_t k=0; k < order.size(); ++k)
+    {
+        class_map[order[k]] = k;
+        sorted_classes[k] = std::move(read_classes[order[k]]);
+    }
+    read_classes.swap(sorted_classes);
+    for (auto & class_id : read_name_classes)
+        class_id = class_map[class_id];
+
+    for (auto & rc : read_classes)
+        rc.compact_bins();
+}
+
+//collect the sam files to process. throws if the input does not exist, so
+//slimm serve and libslimm can report it instead of exiting.
 inline void slimm::collect_bam_files()
 {
     number_of_files = 1;
+    if ((options.is_directory || options.from_partials) && !is_directory(toCString(options.input_path)))
+        throw std::runtime_error(options.input_path + " is not a directory.");
     if (options.is_directory)
     {
-        _input_paths = get_bam_files_in_directory(options.input_path);
+        if (options.from_state)
+            _input_paths = get_files_in_directory(options.input_path, {".slst"});
+        else
+            _input_paths = get_files_in_directory(options.input_path, {".sam", ".bam"});
         number_of_files = length(_input_paths);
         if (options.verbose)
-            std::cerr << number_of_files << " SAM/BAM Files found under the directory: " << options.input_path << "!\n";
+            std::cerr << number_of_files << (options.from_state ? " saved states" : " SAM/BAM Files")
+                      << " found under the directory: " << options.input_path << "!\n";
     }
     else
     {
-        if (is_file(toCString(options.input_path)))
+        // no input file: the alignments are added with add_hit()
+        if (options.input_path.empty() || options.from_partials || is_file(toCString(options.input_path)))
             _input_paths.push_back(options.input_path);
         else
+            throw std::runtime_error(options.input_path + " is not a file use -d option for a directory.");
+    }
+}
+
+float slimm::coverage_cut_off()
+{
+    if (_coverage_cut_off == 0.0 && options.cov_cut_off < 1.0)
+    {
+        std::vector<float> covs = {};
+        covs.reserve(length(references));
+        for (uint32_t i=0; i<length(references); ++i)
+        {
+            if (references[i].uniq_reads_count > 0)
+            {
+                covs.push_back(references[i].cov_percent());
+            }
+        }
+        _coverage_cut_off = get_quantile_cut_off<float>(covs, options.cov_cut_off);
+    }
+    return _coverage_cut_off;
+}
+
+float slimm::expected_coverage() const
+{
+    return float(avg_read_length * matches_count) / matched_ref_length;
+}
+
+// the references with enough coverage to be considered present
+inline void slimm::select_references()
+{
+    uint32_t reference_count = length(references);
+    for (uint32_t i=0; i < reference_count; ++i)
+    {
+        if (references[i].reads_count == 0)
+            continue;
+        if (references[i].cov_percent() >= coverage_cut_off() &&
+            references[i].uniq_cov_percent() >= uniq_coverage_cut_off() && true)
+        {
+            valid_ref_ids.insert(i);
+        }
+        else
+        {
+            if(references[i].uniq_cov_percent() < uniq_coverage_cut_off())
+            {
+                ++failed_byUniqCov;
+            }
+            if(references[i].reads_count < options.min_reads)
+            {
+                ++failed_by_min_read;
+            }
+            if(references[i].cov_percent() < coverage_cut_off())
+            {
+                ++failed_byCov;
+            }
+        }
+    }
+
+}
+
+inline void slimm::filter_alignments()
+{
+    uint32_t reference_count = length(references);
+    if (!preset_references)
+        select_references();
+
+    std::vector<bool> is_valid(reference_count, false);
+    for (auto ref_id : valid_ref_ids)
+        is_valid[ref_id] = true;
+
+    // drop the invalid targets of every read class. classes left with the
+    // same targets are merged.
+    std::unordered_map<std::vector<uint32_t>, uint32_t, target_set_hash> target_set__class;
+    std::vector<read_class> filtered_classes;
+    std::vector<uint32_t> target_set;
+    // the class every read class was merged into
+    std::vector<uint32_t> class_map;
+    std::vector<read_class> const & input_classes = shared_read_classes ? *shared_read_classes : read_classes;
+    class_map.reserve(input_classes.size());
+    for (auto const & rc : input_classes)
+    {
+        target_set.clear();
+        size_t uniq_target = 0;
+        for (size_t i=0; i < rc.targets.size(); ++i)
+        {
+            if (is_valid[rc.targets[i]])
+            {
+                target_set.push_back(rc.targets[i]);
+                uniq_target = i;
+            }
+        }
+        if (target_set.empty())
+        {
+            class_map.push_back(db_image::NOT_FOUND);
+            continue;
+        }
+
+        if (target_set.size() == 1)
+        {
+            uint32_t reference_id = target_set[0];
+            references[reference_id].uniq_reads_count2 += rc.count;
+            uniq_matches_count2 += rc.count;
+            if (rc.targets.size() == 1)
+            {
+                std::vector<uint32_t> const & uniq_bins = references[reference_id].uniq_cov.bins_height;
+                std::vector<uint32_t> & uniq_bins2 = references[reference_id].uniq_cov2.bins_height;
+                for (size_t i=0; i < uniq_bins.size(); ++i)
+                    uniq_bins2[i] += uniq_bins[i];
+            }
+            else
+            {
+                for (auto const & bin : rc.first_bins[uniq_target])
+                    references[reference_id].uniq_cov2.bins_height[bin.first] += bin.second;
+            }
+        }
+
+        auto found = target_set__class.find(target_set);
+        if (found == target_set__class.end())
+        {
+            class_map.push_back(filtered_classes.size());
+            target_set__class.emplace(target_set, filtered_classes.size());
+            filtered_classes.push_back(read_class());
+            filtered_classes.back().targets = target_set;
+            filtered_classes.back().count = rc.count;
+        }
+        else
+        {
+            class_map.push_back(found->second);
+            filtered_classes[found->second].count += rc.count;
+        }
+    }
+    read_classes.swap(filtered_classes);
+    shared_read_classes = nullptr;
+
+    SEQAN_OMP_PRAGMA(parallel for)
+    for (int64_t i=0; i < int64_t(read_name_classes.size()); ++i)
+        if (read_name_classes[i] != db_image::NOT_FOUND)
+            read_name_classes[i] = class_map[read_name_classes[i]];
+}
+
+// the reads of every reference given the counts of the (filtered) read
+// classes. the unique reads of a reference are its single target class. with
+// EM the ambiguous reads are redistributed among their valid targets.
+// returns the number of EM iterations.
+inline uint32_t slimm::get_ref_reads_counts(std::vector<uint32_t> & ref_counts,
+                                            std::vector<uint32_t> const & class_counts) const
+{
+    ref_counts.assign(references.size(), 0);
+    for (uint32_t k=0; k < read_classes.size(); ++k)
+        if (read_classes[k].targets.size() == 1)
+            ref_counts[read_classes[k].targets[0]] += class_counts[k];
+    if (!options.em)
+        return 0;
+
+    // valid references at dense positions
+    std::vector<uint32_t> ref_ids(valid_ref_ids.begin(), valid_ref_ids.end());
+    std::unordered_map<uint32_t, uint32_t> ref_id__pos;
+    std::vector<double> lengths, uniq_counts;
+    for (uint32_t i=0; i < ref_ids.size(); ++i)
+    {
+        ref_id__pos[ref_ids[i]] = i;
+        lengths.push_back(references[ref_ids[i]].length);
+        uniq_counts.push_back(ref_counts[ref_ids[i]]);
+    }
+
+    // the ambiguous read classes over the dense positions
+    std::vector<read_class> classes;
+    for (uint32_t k=0; k < read_classes.size(); ++k)
+    {
+        if (read_classes[k].targets.size() < 2)
+            continue;
+        classes.push_back(read_class());
+        for (auto ref_id : read_classes[k].targets)
+            classes.back().targets.push_back(ref_id__pos.at(ref_id));
+        classes.back().count = class_counts[k];
+    }
+
+    // the rounded counts keep adding up to the reads of the references
+    uint64_t total_count = std::accumulate(uniq_counts.begin(), uniq_counts.end(), uint64_t(0));
+    for (auto const & rc : classes)
+        total_count += rc.count;
+
+    std::vector<double> counts;
+    std::vector<uint32_t> rounded_counts;
+    uint32_t iterations = em_abundance(counts, classes, uniq_counts, lengths,
+                                       options.em_tolerance, options.em_max_iterations);
+    apportion_counts(rounded_counts, counts, total_count);
+    for (uint32_t i=0; i < ref_ids.size(); ++i)
+        ref_counts[ref_ids[i]] = rounded_counts[i];
+    return iterations;
+}
+
+// redistribute the reads with multiple valid targets among them by EM
+inline void slimm::em_reassign_reads()
+{
+    std::vector<uint32_t> class_counts, ref_counts;
+    for (auto const & rc : read_classes)
+        class_counts.push_back(rc.count);
+    uint32_t iterations = get_ref_reads_counts(ref_counts, class_counts);
+    for (uint32_t i=0; i < references.size(); ++i)
+        references[i].em_reads_count = ref_counts[i];
+
+    if (options.verbose)
+        std::cerr << "\n  " << read_classes.size() << " read classes, " << iterations << " EM iterations.\n";
+}
+
+// read the alignments of the current file into the references and read classes
+inline bool slimm::read_alignments(Timer<> & stop_watch)
+{
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+    BamFileIn bam_file;
+    BamHeader bam_header;
+
+    if (!read_bam_file(bam_file, bam_header, current_bam_file_path()))
+        return false;
+
+    //get average read length from a sample (size = 100K)
+    avg_read_length = get_avg_read_length(bam_file, 100000);
+
+    //if bin_width is not given use avg read length
+    if (options.bin_width == 0)
+        options.bin_width = avg_read_length;
+
+    //reset the bam_file to the first recored by closing and reopening
+    close(bam_file);
+
+    read_bam_file(bam_file, bam_header, current_bam_file_path());
+
+    StringSet<CharString>    contig_names = contigNames(context(bam_file));
+    StringSet<uint32_t>      refLengths;
+    refLengths = contigLengths(context(bam_file));
+
+    log_stream<<"Intializing coverages for all reference genome ... ";
+    init_references(contig_names, refLengths);
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    log_stream<<"Analysing alignments, reads and references ....... ";
+    analyze_alignments(bam_file);
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    return true;
+}
+
+// merge the partial states written by slimm map for the shards of a sample.
+// the shards are replayed in the order of their file names, as if their
+// alignments were read from a single file.
+inline bool slimm::read_partials(Timer<> & stop_watch)
+{
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+    std::vector<std::string> partial_paths = get_files_in_directory(current_bam_file_path(), {".slmp"});
+    std::sort(partial_paths.begin(), partial_paths.end());
+    if (partial_paths.empty())
+    {
+        std::cerr << "[ERROR!] No partial states (.slmp) found under " << current_bam_file_path() << "\n";
+        return false;
+    }
+
+    // the headers first: the average read length of the whole sample sets the bins
+    partial_state first, partial;
+    uint32_t sampled_count = 0, sampled_length = 0;
+    for (uint32_t i=0; i < partial_paths.size(); ++i)
+    {
+        partial_state & header = (i == 0) ? first : partial;
+        if (!header.load(partial_paths[i], false))
+            return false;
+        if (!header.same_references(first))
+        {
+            std::cerr << "[ERROR!] " << partial_paths[i] << " was mapped against other references than "
+                      << partial_paths[0] << "\n";
+            return false;
+        }
+        for (uint32_t j=0; j < header.sampled_read_lengths.size() && sampled_count < READ_LENGTH_SAMPLE_SIZE; ++j)
+        {
+            sampled_length += header.sampled_read_lengths[j];
+            ++sampled_count;
+        }
+    }
+    if (sampled_count == 0)
+    {
+        std::cerr << "[ERROR!] None of the reads in " << current_bam_file_path() << " has a sequence.\n";
+        return false;
+    }
+    avg_read_length = sampled_length / sampled_count;
+    if (options.bin_width == 0)
+        options.bin_width = avg_read_length;
+
+    StringSet<CharString> contig_names;
+    for (auto const & name : first.contig_names)
+        appendValue(contig_names, CharString(name.c_str()));
+
+    log_stream<<"Intializing coverages for all reference genome ... ";
+    init_references(contig_names, first.contig_lengths);
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    log_stream<<"Merging the reads of the partial states .......... ";
+    uint32_t const chunk_size = 1 << 12;
+    for (auto const & partial_path : partial_paths)
+    {
+        if (!partial.load(partial_path, true))
+            return false;
+        hits_count += partial.hits_count;
+        // a read is only once in a partial, so the order of its hits is kept
+        uint32_t reads_count = partial.read_keys.size();
+        parallel_for_tasks((reads_count + chunk_size - 1) / chunk_size, [&](int64_t c)
+        {
+            std::string read_key;
+            uint32_t chunk_end = std::min(reads_count, uint32_t(c + 1) * chunk_size);
+            for (uint32_t i = c * chunk_size; i < chunk_end; ++i)
+            {
+                read_key.assign(reinterpret_cast<char const *>(&partial.read_keys[i]), sizeof(uint64_t));
+                for (uint32_t h = partial.hit_offsets[i]; h < partial.hit_offsets[i+1]; ++h)
+                    reads.add_target(read_key, partial.hit_refs[h],
+                                     get_bin_number(partial.hit_refs[h], partial.hit_positions[h]));
+            }
+        });
+    }
+    partial = partial_state();
+    finish_ingest();
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    return true;
+}
+
+// Intialize coverages for all genomes of a SAM/BAM header
+template <typename TLengths>
+inline void slimm::init_references(StringSet<CharString> const & contig_names, TLengths const & contig_lengths)
+{
+    uint32_t references_count = length(contig_names);
+    references.resize(references_count);
+
+    std::vector<std::string> accessions;
+    std::vector<TLinage> linages;
+    if (!shared_references || !shared_references->get(contig_names, accessions, linages))
+    {
+        accessions.resize(references_count);
+        linages.assign(references_count, TLinage());
+        for (uint32_t i=0; i < references_count; ++i)
+        {
+            accessions[i] = db.get_accession(contig_names[i]);
+            uint32_t ac_index = db.find_accession(accessions[i]);
+            if(ac_index != db_image::NOT_FOUND)
+            {
+                uint32_t const * ac_linage = db.linage(ac_index);
+                std::copy(ac_linage, ac_linage + LINAGE_LENGTH, linages[i].begin());
+            }
+        }
+        if (shared_references)
+            shared_references->put(contig_names, accessions, linages);
+    }
+
+    for (uint32_t i=0; i < references_count; ++i)
+    {
+        uint32_t ref_length = contig_lengths[i];
+        reference_contig current_ref(accessions[i], linages[i], ref_length, options.bin_width);
+        references[i] = current_ref;
+    }
+}
+
+// get taxonomic profiles from the sam/bam
+inline void slimm::get_profiles()
+{
+    Timer<>  stop_watch;
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+
+    log_stream  << "\nReading " << current_file_index + 1 << " of " << number_of_files << " files ... ("
+                << get_file_name(current_bam_file_path()) << ")\n"
+                <<"=================================================================\n";
+
+    // a saved state can be profiled at any multiple of its bin width
+    uint32_t bin_width = options.from_state ? _requested_bin_width : options.bin_width;
+    if (!ingest_sample(stop_watch) || (bin_width != 0 && !coarsen_sample(bin_width)))
+    {
+        add_failure(get_file_name(current_bam_file_path()) + " could not be read");
+        return;
+    }
+    profile_sample(stop_watch);
+}
+
+// read the alignments of the current file or its saved state
+inline bool slimm::ingest_sample(Timer<> & stop_watch)
+{
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+    if (options.from_state)
+    {
+        log_stream<<"Loading the saved state of the sample ............ ";
+        if (!load_state(current_bam_file_path()))
+            return false;
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+    else
+    {
+        if (!(options.from_partials ? read_partials(stop_watch) : read_alignments(stop_watch)))
+            return false;
+        if (options.save_state)
+        {
+            log_stream<<"Saving the state of the sample ................... ";
+            save_state();
+            log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+        }
+    }
+    return true;
+}
+
+// record an input or report that failed. the reasons are printed where they
+// happen, slimm serve answers the failures to the client and slimm exits
+// with an error status.
+inline void slimm::add_failure(std::string const & message)
+{
+    std::cerr << "[ERROR!] " << message << "\n";
+    std::lock_guard<std::mutex> lock(_failures_mutex);
+    failures.push_back(message);
+}
+
+// take over the failures of a worker
+inline void slimm::add_failures(slimm const & other)
+{
+    std::lock_guard<std::mutex> lock(_failures_mutex);
+    failures.insert(failures.end(), other.failures.begin(), other.failures.end());
+}
+
+// filter, assign the reads to taxa and write the reports
+inline void slimm::profile_sample(Timer<> & stop_watch)
+{
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+
+    if (hits_count == 0)
+    {
+        log_stream << "[WARNING] No mapped reads found in BAM file!" << std::endl;
+        return;
+    }
+
+    compute_profile(log_stream, stop_watch);
+
+    if (async_reports)
+    {
+        log_stream<<"Handing the reports to the writer thread ......... ";
+        write_reports_async();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+    else
+    {
+        write_reports(log_stream, stop_watch);
+    }
+
+    log_stream<<"[Done!] File took " << stop_watch.elapsed() <<" secs to process.\n";
+}
+
+// filter the ingested sample and assign its reads to taxa
+inline void slimm::compute_profile(std::ostream & log_stream, Timer<> & stop_watch)
+{
+    // Set the minimum reads to 10k-th of the total number of matched reads if not set by the user
+    if (options.min_reads == 0)
+      options.min_reads = 1 + ((matches_count - 1) / 10000);
+    if (options.verbose)
+        print_matches_stat();
+
+    log_stream   << "Filtering unlikely sequences ..................... ";
+    filter_alignments();
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    if (options.verbose)
+        print_filter_stat();
+
+    if (options.em)
+    {
+        log_stream<<"Reassigning multi-mapping reads (EM) ............. ";
+        em_reassign_reads();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+
+    log_stream<<"Assigning reads to Least Common Ancestor (LCA) ... ";
+    get_reads_lca_count();
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    if (options.bootstrap_count > 0)
+    {
+        log_stream<<"Bootstrapping " << std::setw(5) << options.bootstrap_count << " replicates ............... ";
+        bootstrap();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+}
+
+// write the reports of the profiled sample
+inline void slimm::write_reports(std::ostream & log_stream, Timer<> & stop_watch)
+{
+    // the per-read assignments are written alongside the other reports
+    std::thread read_writer;
+    if (!options.read_output.empty())
+        read_writer = std::thread(&slimm::write_read_assignments, this);
+
+    if (options.raw_output)
+    {
+        log_stream<<"Writing features to a file ....................... ";
+        write_raw_stat();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+
+    if (options.coverage_output)
+    {
+        log_stream<<"Writing coverage profiles to a file ....................... ";
+        if (options.coverage_format == "bgzf")
+            write_coverage_bgzf();
+        else
+            write_coverage();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+
+    log_stream<<"Writing taxnomic profile(s) ...................... ";
+    for (auto rank : considered_ranks)
+        write_abundance(rank);
+    if (options.verbose)
+        log_stream<<"\n.................................................. ";
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    if (read_writer.joinable())
+    {
+        log_stream<<"Writing the per-read assignments ................. ";
+        read_writer.join();
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+}
+
+// move the results of the profiled sample into a snapshot and write its
+// reports on a background thread while the next file is read. the reports
+// of the previous file are waited for first, so at most one is in flight.
+inline void slimm::write_reports_async()
+{
+    wait_for_reports();
+
+    std::unique_ptr<slimm> snapshot(new slimm(options, db, current_bam_file_path()));
+    snapshot->quiet                     = true;
+    snapshot->avg_read_length           = avg_read_length;
+    snapshot->matched_ref_length        = matched_ref_length;
+    snapshot->reference_count           = reference_count;
+    snapshot->hits_count                = hits_count;
+    snapshot->uniq_hits_count           = uniq_hits_count;
+    snapshot->matches_count             = matches_count;
+    snapshot->uniq_matches_count        = uniq_matches_count;
+    snapshot->uniq_matches_count2       = uniq_matches_count2;
+    snapshot->valid_ref_ids             = std::move(valid_ref_ids);
+    snapshot->read_classes              = std::move(read_classes);
+    snapshot->read_names                = std::move(read_names);
+    snapshot->read_name_classes         = std::move(read_name_classes);
+    snapshot->class_lcas                = std::move(class_lcas);
+    snapshot->references                = std::move(references);
+    snapshot->taxon_ids                 = std::move(taxon_ids);
+    snapshot->taxa                      = std::move(taxa);
+    snapshot->replicate_taxon_counts    = std::move(replicate_taxon_counts);
+    snapshot->replicate_matches_counts  = std::move(replicate_matches_counts);
+    // the cut-offs are cached across files, see coverage_cut_off()
+    snapshot->copy_settings(*this);
+
+    _report_snapshot = std::move(snapshot);
+    _report_thread = std::thread([this]()
+    {
+        std::ostream no_log(nullptr);
+        Timer<> report_watch;
+        _report_snapshot->write_reports(no_log, report_watch);
+    });
+}
+
+// block until the reports handed to the writer thread are written
+inline void slimm::wait_for_reports()
+{
+    if (_report_thread.joinable())
+        _report_thread.join();
+    if (_report_snapshot)
+        add_failures(*_report_snapshot);
+    _report_snapshot.reset();
+}
+
+// take over the state of a sample ingested by other. without the read
+// classes, which are the bulk of it, they can be shared via shared_read_classes
+inline void slimm::copy_sample(slimm const & other, bool with_read_classes)
+{
+    avg_read_length     = other.avg_read_length;
+    matched_ref_length  = other.matched_ref_length;
+    reference_count     = other.reference_count;
+    hits_count          = other.hits_count;
+    uniq_hits_count     = other.uniq_hits_count;
+    matches_count       = other.matches_count;
+    uniq_matches_count  = other.uniq_matches_count;
+    references          = other.references;
+    if (with_read_classes)
+        read_classes    = other.read_classes;
+}
+
+// take over what the files read before fix for the following ones: the bin
+// width and the minimum reads of the first file and the cached cut-offs
+inline void slimm::copy_settings(slimm const & other)
+{
+    options.bin_width       = other.options.bin_width;
+    options.min_reads       = other.options.min_reads;
+    _coverage_cut_off       = other._coverage_cut_off;
+    _uniq_coverage_cut_off  = other._uniq_coverage_cut_off;
+    _min_reads              = other._min_reads;
+    _min_uniq_reads         = other._min_uniq_reads;
+}
+
+// coarsen the coverages of the ingested sample to bin_width, which has to be
+// a multiple of the bin width the sample was read with
+inline bool slimm::coarsen_sample(uint32_t bin_width)
+{
+    if (bin_width == options.bin_width)
+        return true;
+    if (bin_width % options.bin_width != 0)
+    {
+        std::cerr << "[ERROR!] The bin width " << bin_width << " is not a multiple of "
+                  << options.bin_width << " the sample was read with.\n";
+        return false;
+    }
+    uint32_t factor = bin_width / options.bin_width;
+    for (auto & ref : references)
+        ref.coarsen(factor);
+    for (auto & rc : read_classes)
+        rc.coarsen_bins(factor);
+    options.bin_width = bin_width;
+    return true;
+}
+
+// profile the sample once for every combination of the swept parameters.
+// the alignments are read once at the greatest common divisor of the bin
+// widths and coarsened once per bin width. the combinations are evaluated
+// by at most options.sweep_workers workers, which share the read classes of
+// their width and copy only the references.
+inline void slimm::sweep_profiles()
+{
+    Timer<>  stop_watch;
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+
+    log_stream  << "\nReading " << current_file_index + 1 << " of " << number_of_files << " files ... ("
+                << get_file_name(current_bam_file_path()) << ")\n"
+                <<"=================================================================\n";
+
+    std::vector<uint32_t> bin_widths = options.sweep_bin_widths;
+    std::vector<float> cov_cut_offs = options.sweep_cov_cut_offs;
+    std::vector<float> abundance_cut_offs = options.sweep_abundance_cut_offs;
+    int32_t workers_count = options.sweep_workers > 0 ? options.sweep_workers : options.threads_count;
+    if (bin_widths.empty())
+        bin_widths.push_back(options.bin_width);
+    if (cov_cut_offs.empty())
+        cov_cut_offs.push_back(options.cov_cut_off);
+    if (abundance_cut_offs.empty())
+        abundance_cut_offs.push_back(options.abundance_cut_off);
+
+    // the widths are derived from one ingest at their greatest common divisor
+    // unless it is much finer than the widths (e.g. 1 for 100 and 101), whose
+    // bins would not fit in memory. then every width is read on its own.
+    uint32_t base_width = greatest_common_divisor(bin_widths), min_width = 0;
+    for (auto bin_width : bin_widths)
+        if (bin_width != 0 && (min_width == 0 || bin_width < min_width))
+            min_width = bin_width;
+    std::vector<std::vector<uint32_t> > ingest_widths(1, bin_widths);
+    if (base_width != 0 && base_width * SWEEP_MAX_REFINEMENT < min_width)
+    {
+        std::cerr << "[WARNING] The bin widths have a greatest common divisor of " << base_width
+                  << ". The sample is read once per bin width.\n";
+        ingest_widths.clear();
+        for (auto bin_width : bin_widths)
+            ingest_widths.push_back(std::vector<uint32_t>(1, bin_width));
+    }
+
+    for (auto const & widths : ingest_widths)
+    {
+        reset();
+        options.bin_width = greatest_common_divisor(widths);
+        if (!ingest_sample(stop_watch))
+        {
+            add_failure(get_file_name(current_bam_file_path()) + " could not be read");
+            return;
+        }
+        if (hits_count == 0)
+        {
+            std::cerr << "[WARNING] No mapped reads found in BAM file!" << std::endl;
+            return;
+        }
+
+        // the distinct widths of this ingest, 0 is the width the sample was read with
+        std::vector<uint32_t> sample_widths;
+        for (auto bin_width : widths)
         {
-            std::cerr << options.input_path << " is not a file use -d option for a directory.\n";
-            exit(1);
+            if (bin_width == 0)
+                bin_width = options.bin_width;
+            if (bin_width % options.bin_width != 0)
+            {
+                add_failure("The bin width " + std::to_string(bin_width) + " is not a multiple of " +
+                            std::to_string(options.bin_width) + " the sample was read with");
+                return;
+            }
+            if (std::find(sample_widths.begin(), sample_widths.end(), bin_width) == sample_widths.end())
+                sample_widths.push_back(bin_width);
         }
+
+        // the sample is coarsened once per width. the width it was read with
+        // uses the ingested state itself.
+        log_stream << "Coarsening the sample to " << std::setw(4) << sample_widths.size() << " bin widths ....... ";
+        std::vector<std::unique_ptr<slimm> > width_samples(sample_widths.size());
+        SEQAN_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(workers_count))
+        for (int32_t w=0; w < int32_t(sample_widths.size()); ++w)
+        {
+            if (sample_widths[w] == options.bin_width)
+                continue;
+            std::unique_ptr<slimm> width_sample(new slimm(options, db, current_bam_file_path()));
+            width_sample->quiet = true;
+            // an exception must not leave the parallel region
+            try
+            {
+                width_sample->copy_sample(*this);
+                if (width_sample->coarsen_sample(sample_widths[w]))
+                    width_samples[w] = std::move(width_sample);
+            }
+            catch (std::exception const & e)
+            {
+                width_sample->add_failure(get_file_name(current_bam_file_path()) + " (w" +
+                                          std::to_string(sample_widths[w]) + "): " + e.what());
+            }
+            if (width_sample)
+                add_failures(*width_sample);
+        }
+        // the finer ingested read classes are not needed by any width
+        if (std::find(sample_widths.begin(), sample_widths.end(), options.bin_width) == sample_widths.end())
+            std::vector<read_class>().swap(read_classes);
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+        // a worker per width and coverage cut-off. it shares the read classes
+        // of its width and holds only its own references. the abundance
+        // cut-offs are applied to its profile one after the other.
+        std::vector<std::pair<uint32_t, float> > width_cut_offs;
+        for (uint32_t w=0; w < sample_widths.size(); ++w)
+            if (sample_widths[w] == options.bin_width || width_samples[w])
+                for (auto cov_cut_off : cov_cut_offs)
+                    width_cut_offs.push_back(std::make_pair(w, cov_cut_off));
+
+        log_stream << "Profiling " << std::setw(4) << width_cut_offs.size() * abundance_cut_offs.size()
+                   << " parameter combinations ........ ";
+        SEQAN_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(workers_count))
+        for (int32_t i=0; i < int32_t(width_cut_offs.size()); ++i)
+        {
+            uint32_t bin_width = sample_widths[width_cut_offs[i].first];
+            float cov_cut_off = width_cut_offs[i].second;
+            slimm const & width_sample = width_samples[width_cut_offs[i].first] ?
+                                         *width_samples[width_cut_offs[i].first] : *this;
+            arg_options worker_options = options;
+            worker_options.bin_width = bin_width;
+            worker_options.cov_cut_off = cov_cut_off;
+            worker_options.verbose = false;
+            slimm worker(worker_options, db, current_bam_file_path());
+            worker.quiet = true;
+            // an exception must not leave the parallel region
+            try
+            {
+                worker.copy_sample(width_sample, false);
+                worker.shared_read_classes = &width_sample.read_classes;
+                std::ostream no_log(nullptr);
+                Timer<> worker_watch;
+                worker.compute_profile(no_log, worker_watch);
+                for (auto abundance_cut_off : abundance_cut_offs)
+                {
+                    std::ostringstream tag;
+                    tag << options.output_tag << "_cc" << cov_cut_off << "_ac" << abundance_cut_off
+                        << "_w" << bin_width;
+                    worker.options.abundance_cut_off = abundance_cut_off;
+                    worker.options.output_tag = tag.str();
+                    worker.write_reports(no_log, worker_watch);
+                }
+            }
+            catch (std::exception const & e)
+            {
+                worker.add_failure(get_file_name(current_bam_file_path()) + " (cc" + std::to_string(cov_cut_off) +
+                                   "_w" + std::to_string(bin_width) + "): " + e.what());
+            }
+            add_failures(worker);
+        }
+        log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
     }
+    log_stream<<"[Done!] File took " << stop_watch.elapsed() <<" secs to process.\n";
 }
 
-float slimm::coverage_cut_off()
-{
-    if (_coverage_cut_off == 0.0 && options.cov_cut_off < 1.0)
+// profile all the files jointly. the samples are ingested in parallel and the
+// references are selected once on the coverage pooled over all samples, so a
+// genome is either present in every profile or in none. each sample is then
+// filtered and profiled on its own. all ingested samples are held in memory.
+inline void slimm::joint_profiles()
+{
+    Timer<>  stop_watch;
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
+
+    log_stream  << "\nReading " << number_of_files << " files jointly\n"
+                <<"=================================================================\n";
+
+    log_stream<<"Ingesting the samples ............................ ";
+    shared_references.reset(new reference_cache());
+    std::vector<std::unique_ptr<slimm> > samples(number_of_files);
+    std::vector<char> ingested(number_of_files, false);
+    SEQAN_OMP_PRAGMA(parallel for schedule(dynamic))
+    for (int32_t i=0; i < int32_t(number_of_files); ++i)
+    {
+        samples[i].reset(new slimm(options, db, _input_paths[i]));
+        samples[i]->quiet = true;
+        samples[i]->shared_references = shared_references;
+        samples[i]->options.verbose = false;
+        Timer<> sample_watch;
+        // an exception must not leave the parallel region
+        try
+        {
+            ingested[i] = samples[i]->ingest_sample(sample_watch);
+            if (!ingested[i])
+                samples[i]->add_failure(get_file_name(_input_paths[i]) + " could not be read");
+        }
+        catch (std::exception const & e)
+        {
+            samples[i]->add_failure(get_file_name(_input_paths[i]) + ": " + e.what());
+        }
+    }
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    // bring all samples to a common bin width. saved states may have been
+    // read at different widths.
+    uint32_t bin_width = options.from_state ? _requested_bin_width : options.bin_width;
+    for (uint32_t i=0; i < number_of_files && bin_width == 0; ++i)
+        if (ingested[i])
+            bin_width = samples[i]->options.bin_width;
+    for (uint32_t i=0; i < number_of_files; ++i)
+    {
+        if (!ingested[i])
+            continue;
+        if (samples[i]->hits_count == 0)
+        {
+            std::cerr << "[WARNING] No mapped reads found in "
+                      << get_file_name(samples[i]->current_bam_file_path()) << "!" << std::endl;
+            ingested[i] = false;
+        }
+        else if (!samples[i]->coarsen_sample(bin_width))
+        {
+            samples[i]->add_failure(get_file_name(_input_paths[i]) + " could not be read at the bin width " +
+                                    std::to_string(bin_width));
+            ingested[i] = false;
+        }
+    }
+
+    // pool the samples mapped against the same references as the first one
+    slimm joint(options, db);
+    joint.options.bin_width = bin_width;
+    std::vector<char> pooled(number_of_files, false);
+    for (uint32_t i=0; i < number_of_files; ++i)
     {
-        std::vector<float> covs = {};
-        covs.reserve(length(references));
-        for (uint32_t i=0; i<length(references); ++i)
+        if (!ingested[i])
+            continue;
+        std::vector<reference_contig> const & refs = samples[i]->references;
+        if (joint.references.empty())
         {
-            if (references[i].uniq_reads_count > 0)
-            {
-                covs.push_back(references[i].cov_percent());
-            }
+            joint.references = refs;
+            pooled[i] = true;
+            continue;
         }
-        _coverage_cut_off = get_quantile_cut_off<float>(covs, options.cov_cut_off);
+        bool same_references = refs.size() == joint.references.size();
+        for (uint32_t j=0; same_references && j < refs.size(); ++j)
+            same_references = refs[j].accession == joint.references[j].accession &&
+                              refs[j].length == joint.references[j].length;
+        if (!same_references)
+        {
+            std::cerr << "[WARNING] " << get_file_name(samples[i]->current_bam_file_path())
+                      << " is mapped against other references and is filtered on its own.\n";
+            continue;
+        }
+        for (uint32_t j=0; j < refs.size(); ++j)
+            joint.references[j].pool(refs[j]);
+        pooled[i] = true;
     }
-    return _coverage_cut_off;
-}
 
-float slimm::expected_coverage() const
-{
-    return float(avg_read_length * matches_count) / matched_ref_length;
-}
+    log_stream<<"Selecting references on the pooled coverage ...... ";
+    joint.select_references();
+    for (uint32_t i=0; i < number_of_files; ++i)
+    {
+        if (!pooled[i])
+            continue;
+        samples[i]->valid_ref_ids = joint.valid_ref_ids;
+        samples[i]->failed_byCov = joint.failed_byCov;
+        samples[i]->failed_byUniqCov = joint.failed_byUniqCov;
+        samples[i]->preset_references = true;
+    }
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-inline void slimm::filter_alignments()
-{
-    uint32_t reference_count = length(references);
-    for (uint32_t i=0; i < reference_count; ++i)
+    log_stream<<"Profiling the samples ............................ ";
+    SEQAN_OMP_PRAGMA(parallel for schedule(dynamic))
+    for (int32_t i=0; i < int32_t(number_of_files); ++i)
     {
-        if (references[i].reads_count == 0)
+        if (!ingested[i])
             continue;
-        if (references[i].cov_percent() >= coverage_cut_off() &&
-            references[i].uniq_cov_percent() >= uniq_coverage_cut_off() && true)
+        Timer<> sample_watch;
+        // an exception must not leave the parallel region
+        try
         {
-            valid_ref_ids.insert(i);
+            samples[i]->profile_sample(sample_watch);
         }
-        else
+        catch (std::exception const & e)
         {
-            if(references[i].uniq_cov_percent() < uniq_coverage_cut_off())
-            {
-                ++failed_byUniqCov;
-            }
-            if(references[i].reads_count < options.min_reads)
-            {
-                ++failed_by_min_read;
-            }
-            if(references[i].cov_percent() < coverage_cut_off())
-            {
-                ++failed_byCov;
-            }
+            samples[i]->add_failure(get_file_name(_input_paths[i]) + ": " + e.what());
         }
     }
+    log_stream<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-    for (auto it= reads.begin(); it != reads.end(); ++it)
+    hits_count = 0;
+    for (uint32_t i=0; i < number_of_files; ++i)
     {
-        it->second.update(valid_ref_ids, references);
-        if(it->second.is_uniq())
-        {
-            uint32_t reference_id = (it->second.targets[0]).reference_id;
-            references[reference_id].uniq_reads_count2 += 1;
-            uniq_matches_count2 += 1;
-            uint32_t bin_number = (it->second.targets[0]).positions[0];
-            ++references[reference_id].uniq_cov2.bins_height[bin_number];
-        }
+        add_failures(*samples[i]);
+        if (ingested[i])
+            hits_count += samples[i]->hits_count;
     }
+    log_stream<<"[Done!] " << number_of_files << " files took " << stop_watch.elapsed() <<" secs to process.\n";
 }
 
-// get taxonomic profiles from the sam/bam
-inline void slimm::get_profiles()
+// profile the files of the directory as OpenMP tasks, the largest first. idle
+// threads steal the tasks of other files and the bootstrap replicates spawned
+// within them, so a few large files do not leave the cores idle at the end
+// and small files do not wait for them. at most one file per thread is held
+// in memory. the files up to the first with mapped reads are profiled before
+// the others, which take over its bin width, minimum reads and cut-offs as
+// they would when the files are profiled one after the other. returns the
+// number of alignment records read.
+inline uint32_t slimm::task_profiles()
 {
     Timer<>  stop_watch;
+    std::ostream log_stream(quiet ? nullptr : std::cerr.rdbuf());
 
-    BamFileIn bam_file;
-    BamHeader bam_header;
-
-    std::cerr   << "\nReading " << current_file_index + 1 << " of " << number_of_files << " files ... ("
-                << get_file_name(current_bam_file_path()) << ")\n"
-                <<"=================================================================\n";
+    // a single file input for every file, the reports are named the same
+    arg_options file_options = options;
+    file_options.is_directory = false;
 
-    if (read_bam_file(bam_file, bam_header, current_bam_file_path()))
+    uint32_t done_count = 0;
+    uint32_t total_hits_count = 0;
+    std::unique_ptr<slimm> first;
+    while (done_count < number_of_files && (!first || first->hits_count == 0))
     {
-        //get average read length from a sample (size = 100K)
-        avg_read_length = get_avg_read_length(bam_file, 100000);
-
-        //if bin_width is not given use avg read length
-        if (options.bin_width == 0)
-            options.bin_width = avg_read_length;
-
-        //reset the bam_file to the first recored by closing and reopening
-        close(bam_file);
-
-        read_bam_file(bam_file, bam_header, current_bam_file_path());
-
-        StringSet<CharString>    contig_names = contigNames(context(bam_file));
-        StringSet<uint32_t>      refLengths;
-        refLengths = contigLengths(context(bam_file));
-
-        uint32_t references_count = length(contig_names);
-        references.resize(references_count);
+        std::unique_ptr<slimm> worker(new slimm(file_options, db, _input_paths[done_count]));
+        worker->quiet = true;
+        if (first)
+            worker->copy_settings(*first);
+        worker->get_profiles();
+        total_hits_count += worker->hits_count;
+        add_failures(*worker);
+        first = std::move(worker);
+        log_stream << "[Done!] " << get_file_name(_input_paths[done_count]) << " (" << done_count + 1 << " of "
+                   << number_of_files << ") after " << stop_watch.elapsed() << " secs.\n";
+        ++done_count;
+    }
 
-        std::cerr<<"Intializing coverages for all reference genome ... ";
-        // Intialize coverages for all genomes
+    std::string task_error;
+    std::vector<std::pair<int64_t, uint32_t> > size__file;
+    for (uint32_t i=done_count; i < number_of_files; ++i)
+    {
+        std::ifstream file(_input_paths[i], std::ios::binary | std::ios::ate);
+        size__file.push_back(std::make_pair(int64_t(file.tellg()), i));
+    }
+    std::sort(size__file.begin(), size__file.end(), std::greater<std::pair<int64_t, uint32_t> >());
 
-        for (uint32_t i=0; i < references_count; ++i)
+    SEQAN_OMP_PRAGMA(parallel)
+    SEQAN_OMP_PRAGMA(single)
+    for (auto const & size_file : size__file)
+    {
+        uint32_t i = size_file.second;
+        SEQAN_OMP_PRAGMA(task firstprivate(i))
         {
-            std::string accession = get_accession_id(contig_names[i]);
-            uint32_t taxa_id = 0;
-            auto ac_pos = db.ac__taxid.find(accession);
-            if(ac_pos != db.ac__taxid.end())
+            slimm worker(file_options, db, _input_paths[i]);
+            worker.quiet = true;
+            worker.copy_settings(*first);
+            // an exception must not leave the task, the first is thrown at the end
+            std::string error;
+            try
             {
-                taxa_id = ac_pos->second[0];
+                worker.get_profiles();
             }
-            else
+            catch (std::exception const & e)
             {
-                db.ac__taxid[accession] = std::vector<uint32_t>(LINAGE_LENGTH, 0);
+                error = get_file_name(_input_paths[i]) + ": " + e.what();
             }
-            reference_contig current_ref(accession, taxa_id, refLengths[i], options.bin_width);
-            references[i] = current_ref;
-        }
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-        std::cerr<<"Analysing alignments, reads and references ....... ";
-        analyze_alignments(bam_file);
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-        if (hits_count == 0)
-        {
-            std::cerr << "[WARNING] No mapped reads found in BAM file!" << std::endl;
-            return;
+            SEQAN_OMP_PRAGMA(critical(task_profiles_log))
+            {
+                total_hits_count += worker.hits_count;
+                add_failures(worker);
+                if (task_error.empty())
+                    task_error = error;
+                log_stream << "[Done!] " << get_file_name(_input_paths[i]) << " (" << ++done_count << " of "
+                           << number_of_files << ") after " << stop_watch.elapsed() << " secs.\n";
+            }
         }
+    }
+    if (!task_error.empty())
+        throw std::runtime_error(task_error);
+    return total_hits_count;
+}
 
-        // Set the minimum reads to 10k-th of the total number of matched reads if not set by the user
-        if (options.min_reads == 0)
-          options.min_reads = 1 + ((matches_count - 1) / 10000);
-        if (options.verbose)
-            print_matches_stat();
+// save everything filter_alignments() needs to profile the sample again
+inline void slimm::save_state()
+{
+    std::string state_path = get_tsv_file_name(options.output_prefix, current_bam_file_path()) + ".slst";
+    std::ofstream os(state_path, std::ios::binary);
+    if (!os.is_open())
+    {
+        add_failure("Unable to open " + state_path + " for writing");
+        return;
+    }
+    os.write(SLIMM_STATE_MAGIC, sizeof(SLIMM_STATE_MAGIC));
+    cereal::BinaryOutputArchive out_archive(os);
+    out_archive(SLIMM_STATE_FORMAT_VERSION);
+    out_archive(avg_read_length, options.bin_width, matched_ref_length, reference_count,
+                hits_count, uniq_hits_count, matches_count, uniq_matches_count);
+    out_archive(references, read_classes);
+    os.close();
+    if (!os.good())
+        add_failure("Writing " + state_path + " failed");
+}
 
-        std::cerr   << "Filtering unlikely sequences ..................... ";
-        filter_alignments();
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+// load a state written by save_state() instead of reading the alignments
+inline bool slimm::load_state(std::string const & state_path)
+{
+    std::ifstream is(state_path, std::ios::binary);
+    if (!is.is_open())
+    {
+        std::cerr << "Could not open " << state_path << "!\n";
+        return false;
+    }
+    char magic[sizeof(SLIMM_STATE_MAGIC)] = {};
+    uint32_t version = 0;
+    is.read(magic, sizeof(magic));
+    if (!std::equal(magic, magic + sizeof(magic), SLIMM_STATE_MAGIC))
+    {
+        std::cerr << state_path << " is not a saved slimm state.\n";
+        return false;
+    }
+    cereal::BinaryInputArchive in_archive(is);
+    in_archive(version);
+    if (version != SLIMM_STATE_FORMAT_VERSION)
+    {
+        std::cerr << state_path << " was saved by an incompatible version of slimm.\n";
+        return false;
+    }
+    in_archive(avg_read_length, options.bin_width, matched_ref_length, reference_count,
+               hits_count, uniq_hits_count, matches_count, uniq_matches_count);
+    in_archive(references, read_classes);
 
-        if (options.verbose)
-            print_filter_stat();
+    for (auto & ref : references)
+        ref.uniq_cov2 = bins_coverage(ref.length, ref.cov.bin_width);
+    return true;
+}
 
-        if (options.raw_output)
+// the ranks to write a profile for, from strain upwards
+inline void slimm::get_considered_ranks()
+{
+    std::set<taxa_ranks> ranks;
+    for (auto const & rank : options.ranks)
+    {
+        if(rank == "all")
         {
-            std::cerr<<"Writing features to a file ....................... ";
-            write_raw_stat();
-            std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+            for(uint32_t i=0; i<LINAGE_LENGTH; ++i)
+                ranks.insert(static_cast<taxa_ranks>(i));
         }
-
-        if (options.coverage_output)
+        else
         {
-            std::cerr<<"Writing coverage profiles to a file ....................... ";
-            write_coverage();
-            std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+            ranks.insert(to_taxa_ranks(rank));
         }
-
-        std::cerr<<"Assigning reads to Least Common Ancestor (LCA) ... ";
-        get_reads_lca_count();
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-
-        std::cerr<<"Writing taxnomic profile(s) ...................... ";
-        write_abundance();
-        if (options.verbose)
-            std::cerr<<"\n.................................................. ";
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-
-        std::cerr<<"[Done!] File took " << stop_watch.elapsed() <<" secs to process.\n";
     }
+    considered_ranks.assign(ranks.begin(), ranks.end());
 }
 
-inline void slimm::get_considered_ranks()
+// load the database of the options from a shared memory segment if there is
+// one, from the database file otherwise. throws if neither can be read.
+inline void load_db_image(db_image & db, arg_options const & options)
 {
-    if(options.rank == "all")
-    {
-        for(uint32_t i=8; i>0; --i)
-            considered_ranks.push_back(static_cast<taxa_ranks>(i-1));
-    }
-    else if (options.rank == "superkingdom")
+    if (!options.shared_memory_name.empty())
     {
-        considered_ranks.push_back(to_taxa_ranks(options.rank));
-    }
-    else
-    {
-        considered_ranks.push_back(taxa_ranks(to_taxa_ranks(options.rank) + 1));
-        considered_ranks.push_back(to_taxa_ranks(options.rank));
+        if (db.attach(options.shared_memory_name))
+        {
+            if (options.verbose)
+                std::cerr << "Attached to the shared database " << options.shared_memory_name << ".\n";
+            return;
+        }
+        std::cerr << "[WARNING] No shared database named " << options.shared_memory_name
+                  << " found. Loading " << options.database_path << " privately.\n";
     }
+    slimm_database slimm_db;
+    if (!load_slimm_database(slimm_db, options.database_path))
+        throw std::runtime_error("Unable to load the database " + options.database_path + ".");
+    db.build(slimm_db);
+}
+
+inline void slimm::load_database()
+{
+    load_db_image(*_own_db, options);
 }
 
 inline uint32_t slimm::get_lca(std::set<uint32_t> const & ref_ids)
@@ -521,7 +1807,7 @@ inline uint32_t slimm::get_lca(std::set<uint32_t> const & ref_ids)
         std::set<uint32_t> level_taxa_set = {};
         for(auto ref_id : ref_ids)
         {
-            taxa_id = db.ac__taxid[references[ref_id].accession][i];
+            taxa_id = references[ref_id].linage[i];
             level_taxa_set.insert(taxa_id);
         }
         if(level_taxa_set.size() == 1)
@@ -530,84 +1816,156 @@ inline uint32_t slimm::get_lca(std::set<uint32_t> const & ref_ids)
     return taxa_id;
 }
 
+// dense index of a taxon in the linage of some reference
+inline uint32_t slimm::taxon_index(uint32_t taxa_id) const
+{
+    return std::lower_bound(taxon_ids.begin(), taxon_ids.end(), taxa_id) - taxon_ids.begin();
+}
+
+// the reads of every taxon and of all taxa below it. counts are added along
+// the linage of each source and the contributing references are summarized
+// per taxon in a single pass over the references in order.
 inline void slimm::get_reads_lca_count()
 {
-    // put the non-unique read to upper taxa.
-    for (auto it= reads.begin(); it != reads.end(); ++it)
+    uint32_t ref_count = length(references);
+
+    // dense taxon ids and the linages of the references over them
+    taxon_ids.clear();
+    for (auto const & ref : references)
+        taxon_ids.insert(taxon_ids.end(), ref.linage.begin(), ref.linage.end());
+    std::sort(taxon_ids.begin(), taxon_ids.end());
+    taxon_ids.erase(std::unique(taxon_ids.begin(), taxon_ids.end()), taxon_ids.end());
+    taxa.assign(taxon_ids.size(), taxon_stat());
+
+    dense_linages.resize(ref_count);
+    for (uint32_t i=0; i < ref_count; ++i)
+        for (uint32_t j=0; j < LINAGE_LENGTH; ++j)
+            dense_linages[i][j] = taxon_index(references[i].linage[j]);
+
+    // the taxa an LCA passes its reads (and references) up to
+    lca_first_child.assign(taxa.size(), ref_count);
+    class_lcas.assign(read_classes.size(), db_image::NOT_FOUND);
+    std::vector<std::pair<uint32_t, uint32_t> > ref__lca;
+
+    // with EM the multi-mapping reads are already distributed among references
+    if (!options.em)
     {
-        size_t len = it->second.targets.size();
-        if(len > 1)
+        // put the non-unique read to upper taxa.
+        for (uint32_t k=0; k < read_classes.size(); ++k)
         {
-            uint32_t lca_taxa_id = 0;
-            std::set<uint32_t> ref_ids = {};
-            std::set<uint32_t> taxon_ids;
-            size_t len = it->second.targets.size();
-            for (size_t i=0; i < len; ++i)
+            read_class const & rc = read_classes[k];
+            if(rc.targets.size() > 1)
             {
-                uint32_t ref_id = (it->second.targets[i]).reference_id;
-                ref_ids.insert(ref_id);
-            }
-            lca_taxa_id = get_lca(ref_ids);
-
-            increment_or_initialize(taxon_id__read_count, lca_taxa_id, 1u);
+                std::set<uint32_t> ref_ids(rc.targets.begin(), rc.targets.end());
+                uint32_t lca = taxon_index(get_lca(ref_ids));
 
-            //add the contributing children references to the taxa
-            taxon_id__children[lca_taxa_id].insert(ref_ids.begin(), ref_ids.end());
+                class_lcas[k] = lca;
+                lca_first_child[lca] = std::min(lca_first_child[lca], rc.targets[0]);
+                for (auto ref_id : rc.targets)
+                    ref__lca.push_back(std::make_pair(ref_id, lca));
+            }
         }
+        std::sort(ref__lca.begin(), ref__lca.end());
+        ref__lca.erase(std::unique(ref__lca.begin(), ref__lca.end()), ref__lca.end());
     }
 
-    //add the sum of read counts of children to all ancestors of the LCA // but get a copy first
-    std::unordered_map <uint32_t, uint32_t> taxon_id__read_count_cp = taxon_id__read_count;
-    uint32_t reciever_taxa_id = 0;
-    for (auto t_id : taxon_id__read_count_cp)
+    std::vector<uint32_t> class_counts, ref_counts, taxon_counts;
+    for (auto const & rc : read_classes)
+        class_counts.push_back(rc.count);
+    ref_counts.resize(ref_count);
+    for (uint32_t i=0; i < ref_count; ++i)
+        ref_counts[i] = options.em ? references[i].em_reads_count : references[i].uniq_reads_count2;
+    get_taxon_reads_counts(taxon_counts, ref_counts, class_counts);
+    for (uint32_t t=0; t < taxa.size(); ++t)
+        taxa[t].read_count = taxon_counts[t];
+
+    auto ref_lca = ref__lca.begin();
+    for (uint32_t i=0; i < ref_count; ++i)
     {
-        // get the rank of the taxid
-        taxa_ranks rnk = std::get<0>(db.taxid__name[t_id.first]);
+        uint32_t ref_length = references[i].length;
 
-        //get the first child and then the linage
-        std::string first_child_acc = "";
-        for (auto child : taxon_id__children.at(t_id.first))
+        // the reference contributed to the LCAs of its reads and their ancestors
+        for (; ref_lca != ref__lca.end() && ref_lca->first == i; ++ref_lca)
         {
-            first_child_acc = references[child].accession;
-            break;
+            uint32_t t = ref_lca->second;
+            taxa[t].add_child(i, ref_length);
+            TLinage const & linage = dense_linages[lca_first_child[t]];
+            for (uint32_t j=db.taxon_rank(taxon_ids[t])+1; j < LINAGE_LENGTH; ++j)
+                taxa[linage[j]].add_child(i, ref_length);
         }
-        std::vector<uint32_t> linage = db.ac__taxid[first_child_acc];
-        std::set<uint32_t> ref_ids = taxon_id__children[t_id.first];
 
-        // add the read count to the uper ranks along the linage
-        for (uint32_t j=rnk+1; j < LINAGE_LENGTH; ++j)
+        if (ref_counts[i] > 0)
         {
-            reciever_taxa_id = linage[j];
-            increment_or_initialize(taxon_id__read_count, reciever_taxa_id, t_id.second);
-
-            //add the contributing children references to the taxa
-            taxon_id__children[reciever_taxa_id].insert(ref_ids.begin(), ref_ids.end());
+            TLinage const & linage = dense_linages[i];
+            for (uint32_t j=1; j<LINAGE_LENGTH; ++j)
+                taxa[linage[j]].add_child(i, ref_length);
         }
     }
+}
 
+// the reads of every taxon and of all taxa below it given the reads of the
+// references and the counts of the read classes. needs get_reads_lca_count().
+inline void slimm::get_taxon_reads_counts(std::vector<uint32_t> & taxon_counts,
+                                          std::vector<uint32_t> const & ref_counts,
+                                          std::vector<uint32_t> const & class_counts) const
+{
+    taxon_counts.assign(taxa.size(), 0);
+
+    //add the read counts of the LCA to all of its ancestors
+    std::vector<uint32_t> lca_reads_count(taxa.size(), 0);
+    for (uint32_t k=0; k < class_lcas.size(); ++k)
+        if (class_lcas[k] != db_image::NOT_FOUND)
+            lca_reads_count[class_lcas[k]] += class_counts[k];
+    for (uint32_t t=0; t < taxa.size(); ++t)
+    {
+        if (lca_reads_count[t] == 0)
+            continue;
+        taxon_counts[t] += lca_reads_count[t];
+        TLinage const & linage = dense_linages[lca_first_child[t]];
+        for (uint32_t j=db.taxon_rank(taxon_ids[t])+1; j < LINAGE_LENGTH; ++j)
+            taxon_counts[linage[j]] += lca_reads_count[t];
+    }
 
-    for (uint32_t i=0; i<length(references); ++i)
+    for (uint32_t i=0; i < ref_counts.size(); ++i)
     {
-        if (references[i].uniq_reads_count2 > 0)
-        {
-            std::vector<uint32_t> linage = db.ac__taxid[references[i].accession];
-            std::set<uint32_t> ref_ids = taxon_id__children[linage[0]];
-            for (uint32_t j=1; j<LINAGE_LENGTH; ++j)
-            {
-                reciever_taxa_id = linage[j];
-                auto tid_pos = taxon_id__read_count.find(reciever_taxa_id);
-                // If taxon_id already exists increment it
-                if(tid_pos != taxon_id__read_count.end())
-                    tid_pos->second += references[i].uniq_reads_count2;
-                else
-                    taxon_id__read_count[reciever_taxa_id] = references[i].uniq_reads_count2;
+        if (ref_counts[i] == 0)
+            continue;
+        TLinage const & linage = dense_linages[i];
+        for (uint32_t j=1; j<LINAGE_LENGTH; ++j)
+            taxon_counts[linage[j]] += ref_counts[i];
+    }
+}
 
-                //add the contributing children references to the taxa
-                taxon_id__children[reciever_taxa_id].insert(i);
-                taxon_id__children[reciever_taxa_id].insert(ref_ids.begin(), ref_ids.end());
-            }
+// resample the reads of every read class (poisson bootstrap) and assign them
+// again. the references that passed the filters are kept, as the coverage of
+// the resampled reads is not known.
+inline void slimm::bootstrap()
+{
+    uint32_t kept_count = 0;
+    for (auto const & rc : read_classes)
+        kept_count += rc.count;
+    uint32_t dropped_count = matches_count - kept_count;
+
+    replicate_taxon_counts.assign(options.bootstrap_count, std::vector<uint32_t>());
+    replicate_matches_counts.assign(options.bootstrap_count, 0);
+    parallel_for_tasks(options.bootstrap_count, [&](int64_t r)
+    {
+        // a generator per replicate keeps the result independent of the threads
+        std::mt19937_64 generator(r);
+        std::vector<uint32_t> class_counts(read_classes.size()), ref_counts;
+        uint32_t replicate_matches = 0;
+        for (uint32_t k=0; k < read_classes.size(); ++k)
+        {
+            class_counts[k] = std::poisson_distribution<uint32_t>(read_classes[k].count)(generator);
+            replicate_matches += class_counts[k];
         }
-    }
+        if (dropped_count > 0)
+            replicate_matches += std::poisson_distribution<uint32_t>(dropped_count)(generator);
+
+        get_ref_reads_counts(ref_counts, class_counts);
+        get_taxon_reads_counts(replicate_taxon_counts[r], ref_counts, class_counts);
+        replicate_matches_counts[r] = replicate_matches;
+    });
 }
 
 inline void slimm::print_filter_stat()
@@ -687,85 +2045,96 @@ float slimm::uniq_coverage_cut_off()
     return _uniq_coverage_cut_off;
 }
 
-std::string slimm::get_lineage_string (taxa_ranks rank, std::vector<uint32_t> const & linage)
+std::string slimm::get_lineage_string (taxa_ranks rank, TLinage const & linage)
 {
-    std::string taxon_name = std::get<1>(db.taxid__name[linage[rank]]);
-    if (taxon_name == "")
-    {
-        taxon_name =  "unknown_" + from_taxa_ranks(rank);
-    }
-
-    std::string linage_str = from_taxa_ranks_short(rank) + "__" + taxon_name;
-
-    for (uint32_t i=rank+1; i < LINAGE_LENGTH; ++i)
+    // from superkingdom down to rank. names are appended straight from the db
+    std::string linage_str;
+    for (int32_t i=LINAGE_LENGTH-1; i >= int32_t(rank); --i)
     {
-        taxon_name = std::get<1>(db.taxid__name[linage[i]]);
-        if (taxon_name == "")
-        {
-            taxon_name =  "unknown_" + from_taxa_ranks(taxa_ranks(i));
-        }
-        linage_str = from_taxa_ranks_short(taxa_ranks(i)) + "__" + taxon_name + "|" + linage_str;
+        if (!linage_str.empty())
+            linage_str += "|";
+        linage_str += from_taxa_ranks_short(taxa_ranks(i)) + "__";
+        db_image::name_ref taxon_name = db.taxon_name_ref(linage[i]);
+        if (taxon_name.empty())
+            linage_str += "unknown_" + from_taxa_ranks(taxa_ranks(i));
+        else
+            linage_str.append(taxon_name.data, taxon_name.size);
     }
     return linage_str;
 }
 
 std::string slimm::get_lineage_string (taxa_ranks rank, uint32_t const & taxa_id)
 {
-    std::vector<uint32_t> linage;
-    if(taxa_id == 0)
-    {
-        linage.resize(LINAGE_LENGTH, 0);
-    }
-    else
+    TLinage linage = {};
+    if(taxa_id != 0)
     {
-        std::string child_acc = "";
-        for (auto child : taxon_id__children.at(taxa_id))
-        {
-            child_acc = references[child].accession;
-            break;
-        }
-        linage = db.ac__taxid[child_acc];
+        uint32_t child = taxa[taxon_index(taxa_id)].first_child;
+        linage = references[child].linage;
     }
     return get_lineage_string(rank, linage);
 }
 
 
-inline void slimm::write_abundance()
+// the abundance of a taxon in every bootstrap replicate
+inline std::vector<float> slimm::replicate_abundances(uint32_t taxon) const
+{
+    std::vector<float> abundances(replicate_matches_counts.size(), 0.0);
+    for (size_t r=0; r < abundances.size(); ++r)
+        if (replicate_matches_counts[r] > 0)
+            abundances[r] = float(replicate_taxon_counts[r][taxon])/(replicate_matches_counts[r]) * 100;
+    return abundances;
+}
+
+// the taxon counts are shared by all ranks. one file is written per rank
+// the rows of the profile at rank. returns the number of taxa below the cut-offs.
+inline uint32_t slimm::get_profile_rows(taxa_ranks rank, std::vector<slimm_profile_row> & rows)
 {
-    std::string abundunce_tsv_path = get_tsv_file_name(toCString(options.output_prefix), current_bam_file_path(), "_profile");
-    std::ofstream abundunce_stream(abundunce_tsv_path);
-    abundunce_stream << "taxa_level\ttaxa_id\tlinage\tabundance\tread_count\n";
+    rows.clear();
+    // 95% confidence intervals of the abundances from the bootstrap replicates
+    bool with_ci = !replicate_matches_counts.empty();
+    auto add_row = [&](uint32_t taxa_id, bool unclassified, std::string const & linage_str,
+                       double abundance, uint32_t read_count, std::vector<float> const & replicates)
+    {
+        slimm_profile_row row;
+        row.rank = from_taxa_ranks(rank);
+        row.taxa_id = taxa_id;
+        row.unclassified = unclassified;
+        row.linage = linage_str;
+        row.abundance = abundance;
+        row.read_count = read_count;
+        if (with_ci)
+        {
+            row.abundance_ci_low = get_quantile(replicates, 0.025);
+            row.abundance_ci_high = get_quantile(replicates, 0.975);
+        }
+        rows.push_back(row);
+    };
+    std::vector<float> replicate_sum_abundunce(replicate_matches_counts.size(), 0.0);
+    std::unordered_map <uint32_t, std::vector<float> > replicate_sum_abundunce_by_parent;
 
-    taxa_ranks rank = considered_ranks[1];
-    taxa_ranks parent_rank = considered_ranks[0];
+    // superkingdoms have no parent to put unclassifieds under
+    bool has_parent = rank < superkingdom_lv;
+    taxa_ranks parent_rank = taxa_ranks(rank + 1);
 
     // reserve the statics of un upper level
     std::unordered_map<uint32_t, float>     parent_abundance;
     std::unordered_map<uint32_t, uint32_t>  parent_reads_count;
 
     //get a hold of information at the upper taxon level
-    for (auto t_id : taxon_id__read_count)
+    for (uint32_t t=0; t < taxa.size(); ++t)
     {
-        if (std::get<0>(db.taxid__name[t_id.first]) == parent_rank)
+        if (taxa[t].children_count == 0)
+            continue;
+        if (has_parent && db.taxon_rank(taxon_ids[t]) == parent_rank)
         {
-            uint32_t genome_Length = 0;
-            uint32_t children_count = 0;
-            for (auto child : taxon_id__children.at(t_id.first))
-            {
-                genome_Length += references[child].length;
-                ++children_count;
-            }
-            genome_Length = genome_Length/children_count;
-
-            float abundance = float(t_id.second)/(matches_count) * 100;
+            float abundance = float(taxa[t].read_count)/(matches_count) * 100;
             // New resolution into the unclassifieds
-            parent_abundance[t_id.first] = abundance;
-            parent_reads_count[t_id.first] = t_id.second;
+            parent_abundance[taxon_ids[t]] = abundance;
+            parent_reads_count[taxon_ids[t]] = taxa[t].read_count;
         }
     }
 
 
-    uint32_t    count = 0;
     uint32_t    faild_count = 0;
     uint32_t    sum_reads_count = 0.0;
     float       sum_abundunce = 0.0;
@@ -773,42 +2142,49 @@ inline void slimm::write_abundance()
     std::unordered_map <uint32_t, float>    sum_abundunce_by_parent;
     std::unordered_map <uint32_t, uint32_t> sum_reads_count_by_parent;
 
-    for (auto t_id : taxon_id__read_count)
+    for (uint32_t t=0; t < taxa.size(); ++t)
     {
-        if (std::get<0>(db.taxid__name[t_id.first]) == rank)
+        if (taxa[t].children_count == 0)
+            continue;
+        uint32_t taxa_id = taxon_ids[t];
+        uint32_t read_count = taxa[t].read_count;
+        if (db.taxon_rank(taxa_id) == rank)
         {
-            uint32_t genome_Length = 0;
-            uint32_t children_count = 0;
-            std::string child_acc = "";
-            for (auto child : taxon_id__children.at(t_id.first))
-            {
-                genome_Length += references[child].length;
-                child_acc = references[child].accession;
-                ++children_count;
-            }
-            genome_Length = genome_Length/children_count;
+            // the average length of the references of the taxon hit in this sample,
+            // or of all its references in the database with --db-genome-lengths
+            uint32_t genome_Length = taxa[t].children_length/taxa[t].children_count;
+            if (options.db_genome_lengths && db.genome_length(taxa_id) > 0)
+                genome_Length = db.genome_length(taxa_id);
 
-            std::vector<uint32_t> linage = db.ac__taxid[child_acc];
-            float cov = float(t_id.second * avg_read_length)/genome_Length;
-            float abundance = float(t_id.second)/(matches_count) * 100;
-            std::string candidate_name = std::get<1>(db.taxid__name[t_id.first]);
+            TLinage const & linage = references[taxa[t].last_child].linage;
+            float cov = float(read_count * avg_read_length)/genome_Length;
+            float abundance = float(read_count)/(matches_count) * 100;
+            db_image::name_ref candidate_name = db.taxon_name_ref(taxa_id);
+
+            std::vector<float> replicates = replicate_abundances(t);
 
             // agregate the statstics of the children by parent
-            uint32_t parent_tax_id = linage[parent_rank];
-            increment_or_initialize (sum_abundunce_by_parent, parent_tax_id, abundance);
-            increment_or_initialize (sum_reads_count_by_parent, parent_tax_id, t_id.second);
-            if (abundance < options.abundance_cut_off || cov < coverage_cut_off() || candidate_name == "")
+            if (has_parent)
+            {
+                uint32_t parent_tax_id = linage[parent_rank];
+                increment_or_initialize (sum_abundunce_by_parent, parent_tax_id, abundance);
+                increment_or_initialize (sum_reads_count_by_parent, parent_tax_id, read_count);
+                std::vector<float> & parent_replicates = replicate_sum_abundunce_by_parent[parent_tax_id];
+                parent_replicates.resize(replicates.size(), 0.0);
+                for (size_t r=0; r < replicates.size(); ++r)
+                    parent_replicates[r] += replicates[r];
+            }
+            if (abundance < options.abundance_cut_off || cov < coverage_cut_off() || candidate_name.empty())
             {
                 ++faild_count;
                 continue;
             }
-            std::string linage_str = get_lineage_string(rank, t_id.first);
-            abundunce_stream << from_taxa_ranks(rank) << "\t" << t_id.first << "\t" << linage_str << "\t";
-            abundunce_stream << abundance << "\t" << t_id.second << "\n";
+            add_row(taxa_id, false, get_lineage_string(rank, taxa_id), abundance, read_count, replicates);
 
+            for (size_t r=0; r < replicates.size(); ++r)
+                replicate_sum_abundunce[r] += replicates[r];
             sum_abundunce += abundance;
-            sum_reads_count += t_id.second;
-            ++count;
+            sum_reads_count += read_count;
         }
     }
 
@@ -818,21 +2194,72 @@ inline void slimm::write_abundance()
         uint32_t parent_taxid = ab_by_parent.first;
         float uncl_abundance = parent_abundance[parent_taxid] - sum_abundunce_by_parent[parent_taxid];
         uint32_t unc_read_count = parent_reads_count[parent_taxid] - sum_reads_count_by_parent[parent_taxid];
-        std::string candidate_name = std::get<1>(db.taxid__name[parent_taxid]) + "_unclassified";
-        if (uncl_abundance > options.abundance_cut_off && candidate_name != "_unclassified")
+        db_image::name_ref parent_name = db.taxon_name_ref(parent_taxid);
+        if (uncl_abundance > options.abundance_cut_off && !parent_name.empty())
         {
-            std::string linage_str = get_lineage_string(parent_rank, parent_taxid) + "|" + from_taxa_ranks_short(rank) + "__" + candidate_name;
+            std::string linage_str = get_lineage_string(parent_rank, parent_taxid) + "|" + from_taxa_ranks_short(rank) + "__";
+            linage_str.append(parent_name.data, parent_name.size);
+            linage_str += "_unclassified";
 
-            abundunce_stream << from_taxa_ranks(rank) << "\t" << parent_taxid << "*\t" << linage_str << "\t";
-            abundunce_stream << uncl_abundance << "\t" << unc_read_count << "\n";
+
+            // the parent is in the linage of some reference
+            std::vector<float> replicates(replicate_sum_abundunce.size(), 0.0);
+            if (parent_abundance.count(parent_taxid) > 0)
+                replicates = replicate_abundances(taxon_index(parent_taxid));
+            std::vector<float> const & children_replicates = replicate_sum_abundunce_by_parent[parent_taxid];
+            for (size_t r=0; r < replicates.size(); ++r)
+            {
+                replicates[r] -= children_replicates[r];
+                replicate_sum_abundunce[r] += replicates[r];
+            }
+            add_row(parent_taxid, true, linage_str, uncl_abundance, unc_read_count, replicates);
             sum_reads_count += unc_read_count;
             sum_abundunce += uncl_abundance;
         }
     }
 
-    std::string linage_str = get_lineage_string(rank, 0);
-    abundunce_stream << from_taxa_ranks(rank) << "\t" << "0*" << "\t" << linage_str << "\t";
-    abundunce_stream << 100.0 - sum_abundunce << "\t" << matches_count - sum_reads_count << "\n";
+    for (auto & replicate : replicate_sum_abundunce)
+        replicate = 100.0 - replicate;
+    add_row(0, true, get_lineage_string(rank, 0), 100.0 - sum_abundunce, matches_count - sum_reads_count,
+            replicate_sum_abundunce);
+    return faild_count;
+}
+
+inline void slimm::write_abundance(taxa_ranks rank)
+{
+    std::string suffix = "_profile";
+    if (considered_ranks.size() > 1)
+        suffix = "_" + from_taxa_ranks(rank) + suffix;
+    std::string abundunce_tsv_path = get_tsv_file_name(toCString(options.output_prefix), current_bam_file_path(), options.output_tag + suffix);
+
+    std::vector<slimm_profile_row> rows;
+    uint32_t faild_count = get_profile_rows(rank, rows);
+
+    buffered_writer abundunce_stream(abundunce_tsv_path);
+    if (!abundunce_stream.is_open())
+    {
+        add_failure("Unable to open " + abundunce_tsv_path + " for writing");
+        return;
+    }
+    abundunce_stream << "taxa_level\ttaxa_id\tlinage\tabundance\tread_count";
+    bool with_ci = !replicate_matches_counts.empty();
+    if (with_ci)
+        abundunce_stream << "\tabundance_ci_low\tabundance_ci_high";
+    abundunce_stream << "\n";
+
+    uint32_t count = 0;
+    for (auto const & row : rows)
+    {
+        abundunce_stream << row.rank << "\t" << row.taxa_id;
+        if (row.unclassified)
+            abundunce_stream << "*";
+        else
+            ++count;
+        abundunce_stream << "\t" << row.linage << "\t" << row.abundance << "\t" << row.read_count;
+        if (with_ci)
+            abundunce_stream << "\t" << row.abundance_ci_low << "\t" << row.abundance_ci_high;
+        abundunce_stream << "\n";
+    }
     if (options.verbose)
     {
         std::cerr << "\n" << std::setw (4) << count << std::setw (15) << from_taxa_ranks(rank) <<" ("
@@ -840,50 +2267,187 @@ inline void slimm::write_abundance()
     }
 
     abundunce_stream.close();
+    if (!abundunce_stream.good())
+        add_failure("Writing " + abundunce_tsv_path + " failed");
 }
 
 
 inline void slimm::write_coverage()
 {
-    std::string coverage_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_coverage");
-    std::string uniq_coverage_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverage");
-    std::string uniq_coverage2_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverage2");
-
-    std::ofstream coverage_stream(coverage_csv_path);
-    std::ofstream uniq_coverage_stream(uniq_coverage_csv_path);
-    std::ofstream uniq_coverage2_stream(uniq_coverage2_csv_path);
-
+    std::string coverage_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_coverage");
+    std::string uniq_coverage_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_uniq_coverage");
+    std::string uniq_coverage2_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_uniq_coverage2");
+
+    buffered_writer coverage_stream(coverage_csv_path);
+    buffered_writer uniq_coverage_stream(uniq_coverage_csv_path);
+    buffered_writer uniq_coverage2_stream(uniq_coverage2_csv_path);
+    if (!coverage_stream.is_open() || !uniq_coverage_stream.is_open() || !uniq_coverage2_stream.is_open())
+    {
+        add_failure("Unable to open " + coverage_csv_path + " or the unique coverages for writing");
+        return;
+    }
 
     for (auto valid_id : valid_ref_ids)
     {
-        reference_contig current_ref = references[valid_id];
+        reference_contig const & current_ref = references[valid_id];
         coverage_stream << current_ref.accession;
         uniq_coverage_stream << current_ref.accession;
         uniq_coverage2_stream << current_ref.accession;
-        for (uint32_t ti : db.ac__taxid[current_ref.accession]) {
-            coverage_stream << "," << std::get<1>(db.taxid__name[ti]);
-            uniq_coverage_stream << "," << std::get<1>(db.taxid__name[ti]);
-            uniq_coverage2_stream << "," << std::get<1>(db.taxid__name[ti]);
+        for (uint32_t ti : current_ref.linage) {
+            db_image::name_ref taxon_name = db.taxon_name_ref(ti);
+            coverage_stream << ',';
+            coverage_stream.write(taxon_name.data, taxon_name.size);
+            uniq_coverage_stream << ',';
+            uniq_coverage_stream.write(taxon_name.data, taxon_name.size);
+            uniq_coverage2_stream << ',';
+            uniq_coverage2_stream.write(taxon_name.data, taxon_name.size);
         }
         for (uint32_t b=0; b < current_ref.cov.number_of_bins; ++b)
         {
-            coverage_stream  << "," << current_ref.cov.bins_height[b];
-            uniq_coverage_stream  << "," << current_ref.uniq_cov.bins_height[b];
-            uniq_coverage2_stream  << "," << current_ref.uniq_cov2.bins_height[b];
+            coverage_stream  << ',' << current_ref.cov.bins_height[b];
+            uniq_coverage_stream  << ',' << current_ref.uniq_cov.bins_height[b];
+            uniq_coverage2_stream  << ',' << current_ref.uniq_cov2.bins_height[b];
         }
-        coverage_stream  << "\n" ;
-        uniq_coverage_stream  << "\n";
-        uniq_coverage2_stream  << "\n";
+        coverage_stream  << '\n';
+        uniq_coverage_stream  << '\n';
+        uniq_coverage2_stream  << '\n';
     }
     coverage_stream.close();
     uniq_coverage_stream.close();
     uniq_coverage2_stream.close();
+    if (!coverage_stream.good() || !uniq_coverage_stream.good() || !uniq_coverage2_stream.good())
+        add_failure("Writing " + coverage_csv_path + " or the unique coverages failed");
+}
+
+// the three coverage tracks of every valid reference as little-endian uint32
+// bins (cov, uniq_cov, uniq_cov2) in a BGZF file. each reference starts a new
+// BGZF block whose compressed offset is listed in a tsv index next to it.
+inline void slimm::write_coverage_bgzf()
+{
+    std::string coverage_path = get_tsv_file_name(options.output_prefix, current_bam_file_path()) + options.output_tag + "_coverage.bgz";
+    std::string index_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_coverage_index");
+
+    bgzf_writer coverage_stream(coverage_path);
+    buffered_writer index_stream(index_path);
+    if (!coverage_stream.is_open() || !index_stream.is_open())
+    {
+        add_failure("Unable to open " + coverage_path + " or its index for writing");
+        return;
+    }
+    index_stream << "accession\ttaxa_id\toffset\tbins_count\tbin_width\n";
+
+    for (auto valid_id : valid_ref_ids)
+    {
+        reference_contig const & current_ref = references[valid_id];
+        uint32_t bins_count = current_ref.cov.number_of_bins;
+        index_stream << current_ref.accession << '\t' << current_ref.taxa_id << '\t'
+                     << coverage_stream.start_record() << '\t' << bins_count << '\t'
+                     << current_ref.cov.bin_width << '\n';
+        for (bins_coverage const * track : {&current_ref.cov, &current_ref.uniq_cov, &current_ref.uniq_cov2})
+            for (uint32_t b=0; b < bins_count; ++b)
+                coverage_stream.write_uint32(track->bins_height[b]);
+    }
+    coverage_stream.close();
+    index_stream.close();
+    if (!coverage_stream.good() || !index_stream.good())
+        add_failure("Writing " + coverage_path + " or its index failed");
+}
+
+// the taxon every read was assigned to, kraken style. reads of a class with a
+// single valid reference get the taxon of the reference, the others the LCA of
+// their valid references (also with --em) and unassigned reads 0.
+inline void slimm::write_read_assignments()
+{
+    std::string reads_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_reads");
+    if (options.read_output == "bgzf")
+    {
+        bgzf_writer reads_stream(reads_path + ".gz");
+        if (write_read_rows(reads_stream) && !reads_stream.good())
+            add_failure("Writing " + reads_path + ".gz failed");
+    }
+    else
+    {
+        buffered_writer reads_stream(reads_path);
+        if (write_read_rows(reads_stream) && !reads_stream.good())
+            add_failure("Writing " + reads_path + " failed");
+    }
+}
+
+// returns false if writer could not be opened
+template <typename TWriter>
+inline bool slimm::write_read_rows(TWriter & writer)
+{
+    if (!writer.is_open())
+    {
+        add_failure("Unable to open the per-read assignments of " + get_file_name(current_bam_file_path()) +
+                    " for writing");
+        return false;
+    }
+
+    // the taxon id of every class as text, followed by the accession if unique
+    std::vector<std::string> class_columns(read_classes.size());
+    for (uint32_t k=0; k < read_classes.size(); ++k)
+    {
+        std::vector<uint32_t> const & targets = read_classes[k].targets;
+        uint32_t taxa_id = 0;
+        std::string accession = "-";
+        if (targets.size() == 1)
+        {
+            taxa_id = references[targets[0]].taxa_id;
+            accession = references[targets[0]].accession;
+        }
+        else if (k < class_lcas.size() && class_lcas[k] != db_image::NOT_FOUND)
+        {
+            taxa_id = taxon_ids[class_lcas[k]];
+        }
+        else
+        {
+            taxa_id = get_lca(std::set<uint32_t>(targets.begin(), targets.end()));
+        }
+        class_columns[k] = "C\t\t" + std::to_string(taxa_id) + "\t" + accession + "\n";
+    }
+
+    // rows are formatted into large batches: C/U, read name, taxa id, accession
+    std::string batch;
+    batch.reserve((1 << 22) + 1024);
+    char const * name = read_names.data();
+    for (uint32_t class_id : read_name_classes)
+    {
+        size_t name_length = std::strlen(name);
+        if (class_id == db_image::NOT_FOUND)
+        {
+            batch.append("U\t", 2);
+            batch.append(name, name_length);
+            batch.append("\t0\t-\n", 5);
+        }
+        else
+        {
+            std::string const & columns = class_columns[class_id];
+            batch.append(columns, 0, 2);
+            batch.append(name, name_length);
+            batch.append(columns, 2, std::string::npos);
+        }
+        name += name_length + 1;
+        if (batch.size() >= (1 << 22))
+        {
+            writer.write(batch.data(), batch.size());
+            batch.clear();
+        }
+    }
+    writer.write(batch.data(), batch.size());
+    writer.close();
+    return true;
 }
 
 inline void slimm::write_raw_stat()
 {
-    std::string raw_tsv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_raw");
-    std::ofstream features_stream(raw_tsv_path);
+    std::string raw_tsv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), options.output_tag + "_raw");
+    buffered_writer features_stream(raw_tsv_path);
+    if (!features_stream.is_open())
+    {
+        add_failure("Unable to open " + raw_tsv_path + " for writing");
+        return;
+    }
 
     features_stream <<"accesion\t"
                       "taxaid\t"
@@ -910,13 +2474,15 @@ inline void slimm::write_raw_stat()
 
     for (uint32_t i=0; i < length(references); ++i)
     {
-        reference_contig current_ref = references[i];
-        std::string candidate_name = std::get<1>(db.taxid__name[current_ref.taxa_id]);
-        if (candidate_name == "")
-            candidate_name = "no_name_found";
+        reference_contig & current_ref = references[i];
+        db_image::name_ref candidate_name = db.taxon_name_ref(current_ref.taxa_id);
         features_stream   << current_ref.accession << "\t"
-                          << current_ref.taxa_id << "\t"
-                          << candidate_name << "\t"
+                          << current_ref.taxa_id << "\t";
+        if (candidate_name.empty())
+            features_stream << "no_name_found";
+        else
+            features_stream.write(candidate_name.data, candidate_name.size);
+        features_stream   << "\t"
                           << current_ref.reads_count << "\t"
                           << current_ref.abundance << "\t"
                           << current_ref.uniq_abundance << "\t"
@@ -940,22 +2506,51 @@ inline void slimm::write_raw_stat()
                           << current_ref.uniq_cov_percent2() << "\n";
     }
     features_stream.close();
+    if (!features_stream.good())
+        add_failure("Writing " + raw_tsv_path + " failed");
 }
 
 
-inline int get_taxonomic_profile(arg_options & options)
+// profile all files of slimm1. returns the number of alignment records read.
+inline uint32_t profile_files(slimm & slimm1)
 {
-    // slimm object
-    Timer<>  stop_watch;
+    arg_options const options = slimm1.options;
     uint32_t total_hits_count = 0;
-    slimm slimm1(options);
+    // overlap writing the reports of a file with reading the next one. the
+    // verbose summaries are printed while writing, so they stay in order.
+    slimm1.async_reports = slimm1.number_of_files > 1 && !options.verbose;
+    bool sweep = !options.sweep_bin_widths.empty() || !options.sweep_cov_cut_offs.empty() ||
+                 !options.sweep_abundance_cut_offs.empty();
+    if (options.joint)
+    {
+        slimm1.joint_profiles();
+        return slimm1.hits_count;
+    }
+    // many files share the threads through tasks. with a single thread the
+    // reports of a file are written while the next one is read instead.
+    if (slimm1.number_of_files > 1 && !sweep && !options.verbose && options.threads_count > 1)
+        return slimm1.task_profiles();
+
     for (uint32_t n=0; n < slimm1.number_of_files; ++n)
     {
         slimm1.reset();
         slimm1.current_file_index = n;
-        slimm1.get_profiles();
+        if (sweep)
+            slimm1.sweep_profiles();
+        else
+            slimm1.get_profiles();
         total_hits_count += slimm1.hits_count;
     }
+    slimm1.wait_for_reports();
+    return total_hits_count;
+}
+
+inline int get_taxonomic_profile(arg_options & options)
+{
+    // slimm object
+    Timer<>  stop_watch;
+    slimm slimm1(options);
+    uint32_t total_hits_count = profile_files(slimm1);
 
     std::string output_directory = get_directory(options.output_prefix);
 
@@ -964,6 +2559,13 @@ inline int get_taxonomic_profile(arg_options & options)
     std::cerr << "Taxonomic profiles are written to: \n   " << output_directory <<"\n";
     std::cerr << "Total time elapsed: " << stop_watch.elapsed() <<" secs\n";
 
+    // e.g. slimm reduce on a directory without partial states. scripts must
+    // not take a failed input or report for an empty sample.
+    if (!slimm1.failures.empty())
+    {
+        std::cerr << "[ERROR!] " << slimm1.failures.size() << " input(s) or report(s) failed.\n";
+        return 1;
+    }
     return 0;
 }
 
@@ -42,9 +42,11 @@
 #include <seqan/sequence.h>
 #include <seqan/arg_parse.h>
 #include <seqan/seq_io.h>
+#include <seqan/parallel.h>
 
 #include "misc.hpp"
 #include "file_helper.hpp"
+#include "line_reader.hpp"
 
 using namespace seqan;
 
@@ -54,16 +56,22 @@ using namespace seqan;
 struct arg_options
 {
     uint32_t                     batch;
+    uint32_t                     threads_count;
     bool                         verbose;
+    bool                         ref_metadata;
     std::string                  fasta_path;
+    std::string                  fai_path;
     std::string                  nodes_path;
     std::string                  names_path;
     std::string                  output_path;
     std::vector<std::string>     ac__taxid_paths;
 
     arg_options() : batch(1000000),
+                    threads_count(std::thread::hardware_concurrency()),
                     verbose(false),
+                    ref_metadata(false),
                     fasta_path(),
+                    fai_path(),
                     nodes_path(),
                     names_path(),
                     output_path("slimm_db.sldb"),
@@ -90,7 +98,8 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setHelpText(parser, 0, "A multi-fasta file used as a reference for mapping");
 
     addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "ACCESSION2TAXAID MAP FILES", true));
-    setHelpText(parser, 1, "one ore more accession to taxa id mapping files dowloaded from ncbi (separated by space.)");
+    setHelpText(parser, 1, "one ore more accession to taxa id mapping files dowloaded from ncbi (separated by space.) "
+                           "The files can be gzip or bgzf compressed.");
 
     // The output file argument.
     addOption(parser, ArgParseOption("o", "output-file", "The path to the output file (default slimm_db.sldb)",
@@ -98,11 +107,11 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setValidValues(parser, "output-file", ".sldb");
     setDefaultValue(parser, "output-file", options.output_path);
 
-    addOption(parser, ArgParseOption("nm", "names", "NCBI's names.dmp file which contains the mapping of taxaid to name",
+    addOption(parser, ArgParseOption("nm", "names", "NCBI's names.dmp file (can be compressed) which contains the mapping of taxaid to name",
                              ArgParseArgument::INPUT_FILE));
     setRequired(parser, "names");
 
-    addOption(parser, ArgParseOption("nd", "nodes", "NCBI's nodes.dmp file which contains the taxonomic tree.",
+    addOption(parser, ArgParseOption("nd", "nodes", "NCBI's nodes.dmp file (can be compressed) which contains the taxonomic tree.",
                              ArgParseArgument::INPUT_FILE));
     setRequired(parser, "nodes");
 
@@ -110,6 +119,19 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
                              ArgParseArgument::INTEGER, "INT"));
     setDefaultValue(parser, "batch", options.batch);
 
+    addOption(parser, ArgParseOption("t", "threads", "Specify the number of threads to use.",
+                             ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    setDefaultValue(parser, "threads", options.threads_count);
+
+    addOption(parser, ArgParseOption("rm", "ref-metadata", "Store reference names, reference lengths and "
+                                     "per-taxon genome lengths (for slimm --db-genome-lengths) in the database."));
+
+    addOption(parser, ArgParseOption("fi", "fasta-index", "Take reference names and lengths from the fasta "
+                                     "index (.fai) of FASTA instead of reading the sequences.",
+                                     ArgParseArgument::INPUT_FILE));
+    setValidValues(parser, "fasta-index", ".fai");
+
     addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
 }
 
@@ -138,20 +160,91 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
         getOptionValue(options.output_path, parser, "output-file");
     if (isSet(parser, "batch"))
         getOptionValue(options.batch, parser, "batch");
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads_count, parser, "threads");
     if (isSet(parser, "verbose"))
         getOptionValue(options.verbose, parser, "verbose");
+    if (isSet(parser, "ref-metadata"))
+        options.ref_metadata = true;
+    if (isSet(parser, "fasta-index"))
+        getOptionValue(options.fai_path, parser, "fasta-index");
 
     return ArgumentParser::PARSE_OK;
 }
 
 
+// --------------------------------------------------------------------------
+// Function check_input_stream()
+// --------------------------------------------------------------------------
+inline void check_input_stream(async_line_reader const & input_stream, std::string const & file_path)
+{
+    if (!input_stream.is_open())
+    {
+        std::cerr << "[ERROR!] Unable to open " << file_path << "\n";
+        exit(1);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function get_ref_name()
+// --------------------------------------------------------------------------
+// the name of a reference as it appears in SAM/BAM headers (the fasta id
+// up to the first whitespace)
+inline std::string get_ref_name(CharString const & id)
+{
+    std::string ref_name = toCString(id);
+    size_t ws_pos = ref_name.find_first_of(" \t");
+    if (ws_pos != std::string::npos)
+        ref_name.resize(ws_pos);
+    return ref_name;
+}
+
+// --------------------------------------------------------------------------
+// Function add_reference()
+// --------------------------------------------------------------------------
+inline void add_reference(std::set<std::string> & accessions,
+                          slimm_database & slimm_db,
+                          CharString const & id,
+                          uint32_t ref_length,
+                          arg_options const & options)
+{
+    std::string accession = get_accession_id(id);
+    if (options.ref_metadata)
+    {
+        slimm_db.ref_name__ac[get_ref_name(id)] = accession;
+        increment_or_initialize(slimm_db.ac__length, accession, ref_length);
+    }
+    accessions.insert(accession);
+}
+
 // --------------------------------------------------------------------------
 // Function get_accession_numbers()
 // --------------------------------------------------------------------------
-inline void get_accession_numbers(std::set<std::string> & accessions, arg_options const & options)
+inline void get_accession_numbers(std::set<std::string> & accessions,
+                                  slimm_database & slimm_db,
+                                  arg_options const & options)
 {
-    std::cerr <<"[MSG] getting accessions numbers from fasta file ...\n";
     CharString id;
+
+    // a fasta index has names and lengths without the need to read sequences
+    if (!options.fai_path.empty())
+    {
+        std::cerr <<"[MSG] getting accessions numbers from fasta index ...\n";
+        async_line_reader fai_stream(options.fai_path);
+        check_input_stream(fai_stream, options.fai_path);
+        std::string line;
+        while(fai_stream.getline(line))
+        {
+            std::vector<std::string> columns = split(line, '\t');
+            if (columns.size() < 2)
+                continue;
+            id = columns[0];
+            add_reference(accessions, slimm_db, id, stringToNumber<uint32_t>(columns[1]), options);
+        }
+        return;
+    }
+
+    std::cerr <<"[MSG] getting accessions numbers from fasta file ...\n";
     IupacString seq;
 
     SeqFileIn fasta_file;
@@ -164,7 +257,7 @@ inline void get_accession_numbers(std::set<std::string> & accessions, arg_option
     while(!atEnd(fasta_file))
     {
         readRecord(id, seq, fasta_file);
-        accessions.insert(get_accession_id(id));
+        add_reference(accessions, slimm_db, id, length(seq), options);
     }
     close(fasta_file);
 }
@@ -173,14 +266,14 @@ inline void get_accession_numbers(std::set<std::string> & accessions, arg_option
 // Function get_batch_mappings_ac__taxid()
 // --------------------------------------------------------------------------
 inline bool get_batch_mappings_ac__taxid(std::unordered_map<std::string, uint32_t> & ac__taxid_map,
-                                         std::ifstream & ac__taxid_stream,
+                                         async_line_reader & ac__taxid_stream,
                                          uint32_t const batch_size)
 {
     ac__taxid_map.clear();
     uint32_t taxid = 0, lines_count = 0;
     std::string ac, line, ignore;
 
-    while(std::getline(ac__taxid_stream, line))
+    while(ac__taxid_stream.getline(line))
     {
         std::stringstream   linestream(line);
         std::getline(linestream, ac, '\t'); // first column is accesion
@@ -234,7 +327,8 @@ inline void get_taxid_from_accession(slimm_database & slimm_db,
         if (accessions.size() == 0) // if all accesions are accounted for
             return;
         std::unordered_map<std::string, uint32_t> ac__taxid_map;
-        std::ifstream ac__taxid_stream(map_path);
+        async_line_reader ac__taxid_stream(map_path);
+        check_input_stream(ac__taxid_stream, map_path);
 
         // iterate over a batch of mappings: for memory sake
         uint32_t iter_number  = 1;
@@ -268,7 +362,6 @@ inline void get_taxid_from_accession(slimm_database & slimm_db,
                 }
             }
         }
-        ac__taxid_stream.close();
         ++map_file_number;
     }
 
@@ -278,74 +371,274 @@ inline void get_taxid_from_accession(slimm_database & slimm_db,
 }
 
 // --------------------------------------------------------------------------
-// Function fill_name_taxid_linage()
+// Class dmp_tokenizer
 // --------------------------------------------------------------------------
-inline void fill_name_taxid_linage(slimm_database & slimm_db, arg_options const & options)
+// splits a line of NCBI's taxdump files (nodes.dmp, names.dmp) into its
+// "\t|\t" delimited columns without copying.
+class dmp_tokenizer
 {
-    std::cerr <<"[MSG] loading nodes and names mappings from files ...\n";
-    std::unordered_map<uint32_t, std::tuple<taxa_ranks, uint32_t> > taxid__parent;
-    std::unordered_map<uint32_t, std::string>                       taxid__name;
+public:
+    dmp_tokenizer(std::string const & line) : _line(line) {}
+
+    // points begin and len to the next column. returns false at the end.
+    inline bool next(char const * & begin, size_t & len)
+    {
+        if (_pos > _line.size())
+            return false;
+        size_t end_pos = _line.find("\t|", _pos);
+        if (end_pos == std::string::npos)
+            end_pos = _line.size();
+        begin = _line.data() + _pos;
+        len = end_pos - _pos;
+        _pos = end_pos + 3;
+        return true;
+    }
+
+    // skips a column. returns false at the end.
+    inline bool skip()
+    {
+        char const * begin;
+        size_t len;
+        return next(begin, len);
+    }
+
+    // parses the next column as an unsigned integer.
+    inline bool next(uint32_t & value)
+    {
+        char const * begin;
+        size_t len;
+        if (!next(begin, len) || len == 0)
+            return false;
+        value = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (begin[i] < '0' || begin[i] > '9')
+                return false;
+            value = value * 10 + (begin[i] - '0');
+        }
+        return true;
+    }
 
-    std::ifstream taxid__parent_stream(options.nodes_path);
-    std::ifstream taxid__name_stream(options.names_path);
+private:
+    std::string const & _line;
+    size_t              _pos = 0;
+};
+
+// --------------------------------------------------------------------------
+// Function load_nodes()
+// --------------------------------------------------------------------------
+// loads nodes.dmp into flat vectors indexed by taxid. taxids that are not
+// in the file get a parent of 0.
+inline void load_nodes(std::vector<uint32_t> & taxid__parent,
+                       std::vector<taxa_ranks> & taxid__rank,
+                       std::string const & nodes_path)
+{
+    async_line_reader taxid__parent_stream(nodes_path);
+    check_input_stream(taxid__parent_stream, nodes_path);
 
     uint32_t taxid=0, parent_taxid = 0;
-    std::string line, rank, ignore, name;
+    char const * rank;
+    size_t rank_len;
+    std::string line;
 
-    while(std::getline(taxid__parent_stream, line))
+    while(taxid__parent_stream.getline(line))
     {
-        std::stringstream   linestream(line);
-        linestream >> taxid;// first column is taxid
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, ignore, '\t'); //skip |
-        linestream >> parent_taxid; // third column is parent_taxid
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, rank, '\t'); //fifth column is rank
-        taxid__parent[taxid] = std::make_tuple(to_taxa_ranks(rank), parent_taxid);
+        dmp_tokenizer columns(line);
+        // first column is taxid, second is parent_taxid and third is rank
+        if (!columns.next(taxid) || !columns.next(parent_taxid) || !columns.next(rank, rank_len))
+            continue;
+        if (taxid >= taxid__parent.size())
+        {
+            taxid__parent.resize(taxid + 1 + (taxid >> 3), 0);
+            taxid__rank.resize(taxid__parent.size(), intermidiate_lv);
+        }
+        taxid__parent[taxid] = parent_taxid;
+        taxid__rank[taxid] = to_taxa_ranks(std::string(rank, rank_len));
     }
+}
 
-    taxid__parent_stream.close();
+// --------------------------------------------------------------------------
+// Function load_scientific_names()
+// --------------------------------------------------------------------------
+// loads the scientific names from names.dmp but only for the taxids which
+// are already present in taxid__name.
+inline void load_scientific_names(std::unordered_map<uint32_t, std::tuple<taxa_ranks, std::string> > & taxid__name,
+                                  std::string const & names_path)
+{
+    async_line_reader taxid__name_stream(names_path);
+    check_input_stream(taxid__name_stream, names_path);
+
+    static const std::string scientific_name = "scientific name";
+    uint32_t taxid=0;
+    char const * name;
+    char const * name_class;
+    size_t name_len, name_class_len;
+    std::string line;
 
-    while(std::getline(taxid__name_stream, line))
+    while(taxid__name_stream.getline(line))
     {
-        auto pos = line.find("scientific name", 0);
-        if(pos != std::string::npos)
+        dmp_tokenizer columns(line);
+        // columns are taxid, name, unique name and name class
+        if (!columns.next(taxid))
+            continue;
+        auto tid_pos = taxid__name.find(taxid);
+        if (tid_pos == taxid__name.end())
+            continue;
+        if (!columns.next(name, name_len) || !columns.skip() || !columns.next(name_class, name_class_len))
+            continue;
+        if (scientific_name.compare(0, std::string::npos, name_class, name_class_len) == 0)
+            std::get<1>(tid_pos->second).assign(name, name_len);
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function resolve_linage()
+// --------------------------------------------------------------------------
+// gets the species to superkingdom taxids of taxid. the linages of all the
+// ancestors visited on the way are memoized in linage_cache, so accessions
+// sharing upper linages are resolved by a single lookup.
+inline std::vector<uint32_t> const &
+resolve_linage(uint32_t taxid,
+               std::vector<uint32_t> const & taxid__parent,
+               std::vector<taxa_ranks> const & taxid__rank,
+               std::unordered_map<uint32_t, std::vector<uint32_t> > & linage_cache)
+{
+    static const std::vector<uint32_t> empty_linage(LINAGE_LENGTH, 0);
+
+    // walk up until the root or a memoized ancestor is found.
+    std::vector<uint32_t> path;
+    std::vector<uint32_t> const * upper_linage = &empty_linage;
+    uint32_t tid = taxid;
+    while (tid != 1 && tid < taxid__parent.size() && taxid__parent[tid] != 0)
+    {
+        auto cache_pos = linage_cache.find(tid);
+        if (cache_pos != linage_cache.end())
         {
-            std::stringstream   linestream(line);
-            linestream >> taxid;// first column is taxid
-            std::getline(linestream, ignore, '\t'); //skip |
-            std::getline(linestream, ignore, '\t'); //skip |
-            std::getline(linestream, name, '\t'); // 2nd column is name
-            taxid__name[taxid] = name;
+            upper_linage = &(cache_pos->second);
+            break;
         }
+        path.push_back(tid);
+        tid = taxid__parent[tid];
     }
-    taxid__name_stream.close();
 
-    std::cerr <<"[MSG] getting taxonomic linages and resolving names ...\n";
+    if (path.empty())
+        return *upper_linage;
+
+    // fill the linages back down. the upper most taxid of a rank wins.
+    for (auto it = path.rbegin(); it != path.rend(); ++it)
+    {
+        std::vector<uint32_t> linage = *upper_linage;
+        taxa_ranks current_rank = taxid__rank[*it];
+        if (current_rank >= species_lv && current_rank <= superkingdom_lv && linage[current_rank] == 0)
+            linage[current_rank] = *it;
+        upper_linage = &(linage_cache[*it] = std::move(linage));
+    }
+    return *upper_linage;
+}
+
+// --------------------------------------------------------------------------
+// Function fill_name_taxid_linage()
+// --------------------------------------------------------------------------
+inline void fill_name_taxid_linage(slimm_database & slimm_db, arg_options const & options)
+{
+    std::cerr <<"[MSG] loading nodes mappings from file ...\n";
+    std::vector<uint32_t>   taxid__parent;
+    std::vector<taxa_ranks> taxid__rank;
+    load_nodes(taxid__parent, taxid__rank, options.nodes_path);
+
+    std::cerr <<"[MSG] getting taxonomic linages ...\n";
+    // distinct taxids of the accessions
+    std::vector<std::vector<uint32_t> * >       ac_linages;
+    std::unordered_map<uint32_t, uint32_t>      taxid__index;
+    std::vector<uint32_t>                       taxids;
+    ac_linages.reserve(slimm_db.ac__taxid.size());
     for(auto ac__taxid_it=slimm_db.ac__taxid.begin(); ac__taxid_it != slimm_db.ac__taxid.end(); ++ac__taxid_it)
     {
+        ac_linages.push_back(&(ac__taxid_it->second));
         uint32_t tid = ac__taxid_it->second[0];
-        slimm_db.taxid__name[tid] = std::make_tuple(strain_lv, taxid__name[tid]);
+        if (taxid__index.find(tid) == taxid__index.end())
+        {
+            taxid__index[tid] = taxids.size();
+            taxids.push_back(tid);
+        }
+    }
 
-        while (tid != 1)
+    // resolve the distinct taxids in parallel, each thread with its own cache.
+    std::vector<std::vector<uint32_t> > linages(taxids.size());
+    SEQAN_OMP_PRAGMA(parallel)
+    {
+        std::unordered_map<uint32_t, std::vector<uint32_t> > linage_cache;
+        SEQAN_OMP_PRAGMA(for schedule(dynamic, 1024))
+        for (int64_t i = 0; i < static_cast<int64_t>(taxids.size()); ++i)
         {
-            auto tid_pos = taxid__parent.find(tid);
-            if(tid_pos == taxid__parent.end())
-                break;
+            linages[i] = resolve_linage(taxids[i], taxid__parent, taxid__rank, linage_cache);
+            linages[i][0] = taxids[i];
+        }
+    }
 
-            taxa_ranks current_rank = std::get<0>(tid_pos->second);
-            if (current_rank >= species_lv && current_rank <= superkingdom_lv)
-            {
-                ac__taxid_it->second[current_rank] = tid;
-                slimm_db.taxid__name[tid] = std::make_tuple(current_rank, taxid__name[tid]);
-            }
-            tid = std::get<1>(tid_pos->second);
+    SEQAN_OMP_PRAGMA(parallel for schedule(static))
+    for (int64_t i = 0; i < static_cast<int64_t>(ac_linages.size()); ++i)
+    {
+        std::vector<uint32_t> & ac_linage = *(ac_linages[i]);
+        ac_linage = linages[taxid__index.at(ac_linage[0])];
+    }
+
+    // only the taxids on the linages need a rank and a name.
+    std::unordered_map<uint32_t, std::tuple<taxa_ranks, std::string> > taxid__name;
+    for (auto const & linage : linages)
+    {
+        uint32_t tid = linage[0];
+        taxa_ranks leaf_rank = tid < taxid__rank.size() ? taxid__rank[tid] : strain_lv;
+        if (leaf_rank < species_lv || leaf_rank > superkingdom_lv)
+            leaf_rank = strain_lv;
+        taxid__name[tid] = std::make_tuple(leaf_rank, std::string());
+        for (uint32_t r = species_lv; r <= superkingdom_lv; ++r)
+        {
+            if (linage[r] != 0)
+                taxid__name[linage[r]] = std::make_tuple(taxa_ranks(r), std::string());
         }
     }
+    std::vector<uint32_t>().swap(taxid__parent);
+    std::vector<taxa_ranks>().swap(taxid__rank);
+
+    std::cerr <<"[MSG] resolving names ...\n";
+    load_scientific_names(taxid__name, options.names_path);
+    slimm_db.set_taxa(taxid__name);
 }
 
 
+// --------------------------------------------------------------------------
+// Function fill_genome_lengths()
+// --------------------------------------------------------------------------
+// sets the genome length of every taxon to the average length of the
+// references under it.
+inline void fill_genome_lengths(slimm_database & slimm_db)
+{
+    std::cerr <<"[MSG] computing genome lengths of taxa ...\n";
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint32_t> > taxid__length_sum;
+    for(auto ac__taxid_it=slimm_db.ac__taxid.begin(); ac__taxid_it != slimm_db.ac__taxid.end(); ++ac__taxid_it)
+    {
+        auto len_pos = slimm_db.ac__length.find(ac__taxid_it->first);
+        if (len_pos == slimm_db.ac__length.end())
+            continue;
+        std::set<uint32_t> linage(ac__taxid_it->second.begin(), ac__taxid_it->second.end());
+        linage.erase(0);
+        for (uint32_t tid : linage)
+        {
+            std::pair<uint64_t, uint32_t> & length_sum = taxid__length_sum[tid];
+            length_sum.first += len_pos->second;
+            ++length_sum.second;
+        }
+    }
+    slimm_db.genome_lengths.assign(slimm_db.taxids.size(), 0);
+    for (auto const & length_sum : taxid__length_sum)
+    {
+        uint32_t taxon_idx = slimm_db.taxon_index(length_sum.first);
+        if (taxon_idx != slimm_database::NOT_FOUND)
+            slimm_db.genome_lengths[taxon_idx] = length_sum.second.first / length_sum.second.second;
+    }
+}
+
 // --------------------------------------------------------------------------
 // Function main()
 // --------------------------------------------------------------------------
@@ -363,14 +656,20 @@ int main(int argc, char const ** argv)
     if (res != ArgumentParser::PARSE_OK)
         return res == ArgumentParser::PARSE_ERROR;
 
+#ifdef _OPENMP
+    omp_set_num_threads(options.threads_count);
+#endif
+
     // get the accession numbers from the fasta file
     std::set<std::string> accessions;
-    get_accession_numbers(accessions, options);
-
     slimm_database slimm_db;
+    get_accession_numbers(accessions, slimm_db, options);
+
     // get the taxid from accession numbers
     get_taxid_from_accession(slimm_db, accessions, options);
     fill_name_taxid_linage(slimm_db, options);
+    if (options.ref_metadata)
+        fill_genome_lengths(slimm_db);
     save_slimm_database(slimm_db, options.output_path);
 
 //
@@ -379,7 +678,7 @@ int main(int argc, char const ** argv)
 //    for (uint32_t i=0; i<tids.size(); ++i)
 //    {
 //        std::string r = from_taxa_ranks(static_cast<taxa_ranks>(i));
-//        std::cout << r << "\t" << from_taxa_ranks(std::get<0>(slimm_db.taxid__name[tids[i]])) << "\t" << tids[i] << "\t" << std::get<1>(slimm_db.taxid__name[tids[i]])  << "\n";
+//        std::cout << r << "\t" << from_taxa_ranks(slimm_db.taxon_rank(tids[i])) << "\t" << tids[i] << "\t" << slimm_db.taxon_name(tids[i])  << "\n";
 //    }
 
     return 0;
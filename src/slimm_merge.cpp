@@ -0,0 +1,223 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+
+#include <seqan/basic.h>
+#include <seqan/file.h>
+#include <seqan/sequence.h>
+#include <seqan/arg_parse.h>
+#include <seqan/seq_io.h>
+
+#include "buffered_writer.hpp"
+#include "misc.hpp"
+#include "file_helper.hpp"
+#include "profile_matrix.hpp"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class arg_options
+// ----------------------------------------------------------------------------
+struct arg_options
+{
+    typedef std::vector<std::string>            TList;
+
+    TList valueList = {"abundance", "read_count"};
+
+    bool                         verbose;
+    std::string                  value;
+    std::string                  output_prefix;
+    TList                        input_paths;
+
+    arg_options() : verbose(false),
+                    value("abundance"),
+                    output_prefix("merged"),
+                    input_paths() {}
+};
+
+// ----------------------------------------------------------------------------
+// Function setupArgumentParser()
+// ----------------------------------------------------------------------------
+void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
+{
+    // Setup ArgumentParser.
+    setAppName(parser, "slimm_merge");
+    setShortDescription(parser, "merges the profiles of many samples into a taxa x samples matrix");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    setDescription(parser);
+    // Define usage line and long description.
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIPROFILE\\fP\" ...");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "PROFILE", true));
+    setHelpText(parser, 0, "slimm profiles (*.tsv). Any other file is read as a list of profile paths, one per line.");
+
+    addOption(parser, ArgParseOption("o", "output-prefix", "output path prefix. PREFIX.tsv and PREFIX.slmx are written.",
+                                     ArgParseArgument::OUTPUT_PREFIX));
+    setDefaultValue(parser, "output-prefix", options.output_prefix);
+    addOption(parser, ArgParseOption("c", "value", "The profile column to merge.", ArgParseArgument::STRING, "STR"));
+    setValidValues(parser, "value", options.valueList);
+    setDefaultValue(parser, "value", options.value);
+    addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
+
+    // Add Examples Section.
+    addTextSection(parser, "Examples");
+
+    addListItem(parser,
+                "\\fBslimm_merge\\fP \\fB-o\\fP \\fIall_samples\\fP \\fIprofiles/*_profile.tsv\\fP",
+                "merge the abundances of all profiles under \"\\fIprofiles\\fP\" into "
+                "\"\\fIall_samples.tsv\\fP\" and \"\\fIall_samples.slmx\\fP\".");
+}
+
+// --------------------------------------------------------------------------
+// Function parseCommandLine()
+// --------------------------------------------------------------------------
+ArgumentParser::ParseResult
+parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    options.input_paths.resize(getArgumentValueCount(parser, 0));
+    for (unsigned i = 0; i < options.input_paths.size(); ++i)
+        getArgumentValue(options.input_paths[i], parser, 0, i);
+
+    if (isSet(parser, "output-prefix"))
+        getOptionValue(options.output_prefix, parser, "output-prefix");
+    if (isSet(parser, "value"))
+        getOptionValue(options.value, parser, "value");
+    if (isSet(parser, "verbose"))
+        getOptionValue(options.verbose, parser, "verbose");
+
+    return ArgumentParser::PARSE_OK;
+}
+
+// --------------------------------------------------------------------------
+// Function get_sample_name()
+// --------------------------------------------------------------------------
+// the file name of a profile without the extension
+inline std::string get_sample_name(std::string const & profile_path)
+{
+    std::string sample_name = get_file_name(profile_path);
+    size_t dot_pos = sample_name.find_last_of(".");
+    if (dot_pos != std::string::npos)
+        sample_name.erase(dot_pos);
+    return sample_name;
+}
+
+// --------------------------------------------------------------------------
+// Function main()
+// --------------------------------------------------------------------------
+
+// Program entry point.
+int main(int argc, char const ** argv)
+{
+    // Parse the command line.
+    ArgumentParser parser;
+    arg_options options;
+    setupArgumentParser(parser, options);
+
+    ArgumentParser::ParseResult res = parseCommandLine(parser, options, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    // expand the lists of profiles
+    std::vector<std::string> profile_paths;
+    for (auto const & input_path : options.input_paths)
+    {
+        if (input_path.size() > 4 && input_path.compare(input_path.size() - 4, 4, ".tsv") == 0)
+        {
+            profile_paths.push_back(input_path);
+            continue;
+        }
+        std::ifstream list_stream(input_path);
+        if (!list_stream.is_open())
+        {
+            std::cerr << "[ERROR!] Unable to open " << input_path << "\n";
+            return 1;
+        }
+        std::string path;
+        while (std::getline(list_stream, path))
+        {
+            if (!path.empty())
+                profile_paths.push_back(path);
+        }
+    }
+
+    uint32_t value_column = (options.value == "abundance") ? 3 : 4;
+    profile_matrix matrix;
+    for (auto const & profile_path : profile_paths)
+    {
+        if (!matrix.add_profile(profile_path, get_sample_name(profile_path), value_column))
+        {
+            std::cerr << "[ERROR!] Unable to open " << profile_path << "\n";
+            return 1;
+        }
+        if (options.verbose)
+            std::cerr << "[MSG] " << profile_path << " added. " << matrix.rows_count() << " taxa so far.\n";
+    }
+
+    std::string tsv_path = options.output_prefix + ".tsv";
+    std::string matrix_path = options.output_prefix + ".slmx";
+    buffered_writer tsv_stream(tsv_path);
+    if (!tsv_stream.is_open())
+    {
+        std::cerr << "[ERROR!] Unable to open " << tsv_path << "\n";
+        return 1;
+    }
+    matrix.write_tsv(tsv_stream);
+    tsv_stream.close();
+    if (!tsv_stream.good())
+    {
+        std::cerr << "[ERROR!] Writing " << tsv_path << " failed\n";
+        return 1;
+    }
+    if (!save_profile_matrix(matrix, matrix_path))
+    {
+        std::cerr << "[ERROR!] Unable to open " << matrix_path << "\n";
+        return 1;
+    }
+
+    std::cerr << "[MSG] " << matrix.samples.size() << " samples, " << matrix.rows_count() << " taxa and "
+              << matrix.entry_rows.size() << " non-zero values written to " << tsv_path << " and " << matrix_path << "\n";
+    return 0;
+}
@@ -0,0 +1,251 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#ifndef SLIMM_SERVE_H
+#define SLIMM_SERVE_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+    #include <csignal>
+    #include <cstring>
+    #include <cerrno>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+#endif
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class job_server
+// ----------------------------------------------------------------------------
+// Accepts jobs on a Unix-domain socket and runs them on a fixed number of
+// worker threads. A job is one line of tab separated arguments, answered with
+// the line run_job returns before the connection is closed. The line
+// "shutdown" stops the server once the running jobs are done. Connections
+// wait in a bounded queue while all workers are busy.
+class job_server
+{
+public:
+    typedef std::function<std::string(std::vector<std::string> const &)>    TJobRunner;
+
+    job_server(std::string const & socket_path, uint32_t workers_count, TJobRunner run_job,
+               size_t max_queued_jobs = 256) :
+               _socket_path(socket_path),
+               _workers_count(std::max(workers_count, 1u)),
+               _max_queued_jobs(max_queued_jobs),
+               _run_job(run_job)
+    {}
+
+    ~job_server()
+    {
+        _stop_workers();
+    }
+
+    job_server(job_server const &) = delete;
+    job_server & operator=(job_server const &) = delete;
+
+    // listen and serve until a shutdown job arrives. returns false if the
+    // socket can not be set up.
+    inline bool serve()
+    {
+#ifdef _WIN32
+        std::cerr << "[ERROR!] slimm serve needs Unix-domain sockets.\n";
+        return false;
+#else
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (_socket_path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "[ERROR!] The socket path " << _socket_path << " is too long.\n";
+            return false;
+        }
+        std::strcpy(address.sun_path, _socket_path.c_str());
+
+        // a client that hangs up must not kill the server
+        std::signal(SIGPIPE, SIG_IGN);
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(_socket_path.c_str());
+        // only the user of the server may connect: a job writes files wherever
+        // the server can. the socket is created without group and other rights.
+        mode_t old_mask = umask(0177);
+        int bound = _listen_fd < 0 ? -1 : bind(_listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+        umask(old_mask);
+        if (_listen_fd < 0 || bound != 0 || listen(_listen_fd, 64) != 0)
+        {
+            std::cerr << "[ERROR!] Unable to listen on " << _socket_path << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+
+        for (uint32_t i=0; i < _workers_count; ++i)
+            _workers.push_back(std::thread(&job_server::_work, this));
+
+        while (!_shutdown)
+        {
+            int client_fd = accept(_listen_fd, nullptr, nullptr);
+            if (client_fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // the listening socket was shut down by a shutdown job
+                break;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _not_full.wait(lock, [this]{ return _clients.size() < _max_queued_jobs; });
+            _clients.push_back(client_fd);
+            lock.unlock();
+            _not_empty.notify_one();
+        }
+
+        _stop_workers();
+        close(_listen_fd);
+        unlink(_socket_path.c_str());
+        return true;
+#endif
+    }
+
+private:
+    std::string                 _socket_path;
+    uint32_t                    _workers_count;
+    size_t                      _max_queued_jobs;
+    TJobRunner                  _run_job;
+    std::vector<std::thread>    _workers;
+    std::mutex                  _mutex;
+    std::condition_variable     _not_empty;
+    std::condition_variable     _not_full;
+    std::deque<int>             _clients;
+    std::atomic<bool>           _shutdown{false};
+    bool                        _stop = false;
+    int                         _listen_fd = -1;
+
+    inline void _stop_workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _not_empty.notify_all();
+        for (auto & worker : _workers)
+            worker.join();
+        _workers.clear();
+    }
+
+#ifndef _WIN32
+    // take connections from the queue until the server stops. queued jobs are
+    // still run after a shutdown.
+    inline void _work()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _not_empty.wait(lock, [this]{ return !_clients.empty() || _stop; });
+            if (_clients.empty())
+                return;
+            int client_fd = _clients.front();
+            _clients.pop_front();
+            lock.unlock();
+            _not_full.notify_one();
+
+            _serve_client(client_fd);
+            close(client_fd);
+        }
+    }
+
+    inline void _serve_client(int client_fd)
+    {
+        // read one line of at most 64 KiB
+        std::string line;
+        char buffer[4096];
+        while (line.find('\n') == std::string::npos && line.size() < (1 << 16))
+        {
+            ssize_t n = read(client_fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            line.append(buffer, n);
+        }
+        line = line.substr(0, line.find('\n'));
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::string reply;
+        if (line == "shutdown")
+        {
+            reply = "OK shutting down\n";
+            _shutdown = true;
+            // wakes up accept() in serve()
+            shutdown(_listen_fd, SHUT_RDWR);
+        }
+        else
+        {
+            std::vector<std::string> args;
+            for (size_t begin = 0; begin <= line.size(); )
+            {
+                size_t end = std::min(line.find('\t', begin), line.size());
+                if (end > begin)
+                    args.push_back(line.substr(begin, end - begin));
+                begin = end + 1;
+            }
+            reply = args.empty() ? std::string("ERROR empty job\n") : _run_job(args);
+        }
+
+        for (size_t sent = 0; sent < reply.size(); )
+        {
+            ssize_t n = write(client_fd, reply.data() + sent, reply.size() - sent);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+    }
+#else
+    inline void _work() {}
+#endif
+};
+
+#endif /* SLIMM_SERVE_H */
@@ -0,0 +1,179 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+
+#include <seqan/basic.h>
+#include <seqan/file.h>
+#include <seqan/sequence.h>
+#include <seqan/arg_parse.h>
+#include <seqan/seq_io.h>
+
+#include "misc.hpp"
+#include "shared_database.hpp"
+
+using namespace seqan;
+
+// ----------------------------------------------------------------------------
+// Class arg_options
+// ----------------------------------------------------------------------------
+struct arg_options
+{
+    bool                         remove;
+    bool                         verbose;
+    std::string                  database_path;
+    std::string                  segment_name;
+
+    arg_options() : remove(false),
+                    verbose(false),
+                    database_path(),
+                    segment_name() {}
+};
+
+// ----------------------------------------------------------------------------
+// Function setupArgumentParser()
+// ----------------------------------------------------------------------------
+void setupArgumentParser(ArgumentParser & parser)
+{
+    // Setup ArgumentParser.
+    setAppName(parser, "slimm_shm");
+    setShortDescription(parser, "places a slimm database in shared memory for concurrent slimm processes");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    setDescription(parser);
+    // Define usage line and long description.
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fINAME\\fP\" \"\\fIDB\\fP\"");
+    addUsageLine(parser, "\\fB-r\\fP \"\\fINAME\\fP\"");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "NAME"));
+    setHelpText(parser, 0, "Name of the POSIX shared memory segment. "
+                           "Names containing a '/' are used as file paths, e.g. on a hugetlbfs mount.");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "DB", true));
+    setValidValues(parser, 1, ".sldb");
+
+    addOption(parser, ArgParseOption("r", "remove", "Remove the shared database NAME."));
+    addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
+
+    // Add Examples Section.
+    addTextSection(parser, "Examples");
+
+    addListItem(parser,
+                "\\fBslimm_shm\\fP \\fIslimm_db\\fP \\fIslimm_db_5K.sldb\\fP",
+                "publish \"\\fIslimm_db_5K.sldb\\fP\" as \"\\fIslimm_db\\fP\". "
+                "Then run slimm with \\fB-sm\\fP \\fIslimm_db\\fP to use it.");
+
+    addListItem(parser,
+                "\\fBslimm_shm\\fP \\fB-r\\fP \\fIslimm_db\\fP",
+                "free the memory used by \"\\fIslimm_db\\fP\".");
+}
+
+// --------------------------------------------------------------------------
+// Function parseCommandLine()
+// --------------------------------------------------------------------------
+ArgumentParser::ParseResult
+parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    getArgumentValue(options.segment_name, parser, 0);
+    if (getArgumentValueCount(parser, 1) > 0)
+        getArgumentValue(options.database_path, parser, 1);
+
+    if (isSet(parser, "remove"))
+        options.remove = true;
+    if (isSet(parser, "verbose"))
+        getOptionValue(options.verbose, parser, "verbose");
+
+    if (!options.remove && options.database_path.empty())
+    {
+        std::cerr << "slimm_shm: A database (DB) is required unless -r is given.\n";
+        return ArgumentParser::PARSE_ERROR;
+    }
+
+    return ArgumentParser::PARSE_OK;
+}
+
+// --------------------------------------------------------------------------
+// Function main()
+// --------------------------------------------------------------------------
+
+// Program entry point.
+int main(int argc, char const ** argv)
+{
+    // Parse the command line.
+    ArgumentParser parser;
+    arg_options options;
+    setupArgumentParser(parser);
+
+    ArgumentParser::ParseResult res = parseCommandLine(parser, options, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    if (options.remove)
+    {
+        if (!db_image::remove(options.segment_name))
+        {
+            std::cerr << "[ERROR!] Unable to remove the shared database " << options.segment_name << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    std::cerr <<"[MSG] loading " << options.database_path << " ...\n";
+    db_image db;
+    {
+        slimm_database slimm_db;
+        if (!load_slimm_database(slimm_db, options.database_path))
+            return 1;
+        db.build(slimm_db);
+    }
+
+    if (!db.publish(options.segment_name))
+    {
+        std::cerr << "[ERROR!] Unable to create the shared database " << options.segment_name
+                  << " (does it already exist?)\n";
+        return 1;
+    }
+    std::cerr <<"[MSG] " << db.size() << " bytes published as " << options.segment_name << "\n";
+    return 0;
+}
@@ -0,0 +1,123 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+// Benchmark of read_table against a single std::unordered_map filled by one
+// thread. read_table is filled through its locked add_target() and shard by
+// shard as analyze_alignments() does. Usage: bench_read_table [hits_count]
+
+#include <seqan/basic.h>
+#include <seqan/parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "misc.hpp"
+#include "reference_contig.hpp"
+#include "read_stat.hpp"
+
+using namespace seqan;
+
+typedef std::chrono::steady_clock   TClock;
+
+inline double seconds_since(TClock::time_point start)
+{
+    return std::chrono::duration<double>(TClock::now() - start).count();
+}
+
+int main(int argc, char const ** argv)
+{
+    int64_t hits_count = argc > 1 ? std::stoll(argv[1]) : 4000000;
+    // two hits per read on average, scattered over the input
+    std::vector<std::string> read_keys(hits_count);
+    for (int64_t i = 0; i < hits_count; ++i)
+        read_keys[i] = "read_" + std::to_string((i * 2654435761u) % (hits_count / 2 + 1));
+
+    TClock::time_point start = TClock::now();
+    std::unordered_map<std::string, read_stat> reads;
+    for (int64_t i = 0; i < hits_count; ++i)
+        reads[read_keys[i]].add_target(i % 50, i % 1000);
+    std::cout << "unordered_map\t1 thread\t" << seconds_since(start) << " s\t"
+              << reads.size() << " reads\n";
+
+    for (int threads_count : {1, 2, 4, 8})
+    {
+        read_table table;
+        start = TClock::now();
+        SEQAN_OMP_PRAGMA(parallel for schedule(static, 4096) num_threads(threads_count))
+        for (int64_t i = 0; i < hits_count; ++i)
+            table.add_target(read_keys[i], i % 50, i % 1000);
+        std::cout << "read_table\t" << threads_count << " threads\t" << seconds_since(start) << " s\t"
+                  << table.size() << " reads\n";
+    }
+
+    // the hits are hashed in parallel, grouped by shard with a stable
+    // counting sort and every shard is filled by one thread without locking
+    std::vector<uint32_t> hit_shards(hits_count);
+    std::vector<uint32_t> shard_hits(hits_count);
+    for (int threads_count : {1, 2, 4, 8})
+    {
+        read_table table;
+        uint32_t const shards_count = table.shards_count();
+        std::vector<int64_t> shard_begins(shards_count + 1, 0);
+        start = TClock::now();
+        SEQAN_OMP_PRAGMA(parallel for schedule(static, 4096) num_threads(threads_count))
+        for (int64_t i = 0; i < hits_count; ++i)
+            hit_shards[i] = table.shard_index(read_keys[i]);
+        for (int64_t i = 0; i < hits_count; ++i)
+            ++shard_begins[hit_shards[i] + 1];
+        std::partial_sum(shard_begins.begin(), shard_begins.end(), shard_begins.begin());
+        std::vector<int64_t> shard_ends(shard_begins.begin(), shard_begins.end() - 1);
+        for (int64_t i = 0; i < hits_count; ++i)
+            shard_hits[shard_ends[hit_shards[i]]++] = i;
+        SEQAN_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(threads_count))
+        for (int32_t s = 0; s < int32_t(shards_count); ++s)
+        {
+            read_table::TShard & shard = table.shard(s);
+            for (int64_t k = shard_begins[s]; k < shard_begins[s + 1]; ++k)
+            {
+                int64_t i = shard_hits[k];
+                shard[read_keys[i]].add_target(i % 50, i % 1000);
+            }
+        }
+        std::cout << "read_table shard fill\t" << threads_count << " threads\t" << seconds_since(start) << " s\t"
+                  << table.size() << " reads\n";
+    }
+    return 0;
+}
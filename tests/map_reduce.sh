@@ -0,0 +1,77 @@
+#!/bin/sh
+# ===========================================================================
+# map_reduce.sh SLIMM DB BAM [PARTS]
+#
+# Splits BAM into PARTS (default 4) shards, runs slimm map on them in
+# parallel, merges the partial states with slimm reduce and diffs the
+# reports against those of slimm on the whole BAM. BAM files are read with
+# samtools, SAM files (e.g. example/toy-sample.sam) need no samtools.
+# ===========================================================================
+
+set -e
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 SLIMM DB BAM [PARTS]" >&2
+    exit 2
+fi
+
+SLIMM=$1
+DB=$2
+BAM=$3
+PARTS=${4:-4}
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/slimm_map_reduce.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+mkdir -p "$WORK/shards" "$WORK/parts" "$WORK/whole" "$WORK/reduced"
+
+# slimm reduce replays the partial states in the order of their file names.
+# contiguous shards named in file order give it the records in the order of
+# BAM, so the reports have to be the same as those of the whole file.
+case "$BAM" in
+    *.sam) VIEW="cat" ;;
+    *)     VIEW="samtools view -h" ;;
+esac
+RECORDS=$($VIEW "$BAM" | awk '!/^@/ { ++n } END { print n + 0 }')
+$VIEW "$BAM" | awk -v parts="$PARTS" -v records="$RECORDS" -v dir="$WORK/shards" '
+    BEGIN { for (p = 0; p < parts; ++p) shard[p] = sprintf("%s/shard_%03d.sam", dir, p) }
+    /^@/  { for (p = 0; p < parts; ++p) print > shard[p]; next }
+          { print > shard[int(n++ * parts / records)] }'
+
+PIDS=""
+for SHARD in "$WORK"/shards/*.sam; do
+    NAME=$(basename "$SHARD" .sam)
+    "$SLIMM" map "$SHARD" "$WORK/parts/$NAME.slmp" &
+    PIDS="$PIDS $!"
+done
+for PID in $PIDS; do
+    wait "$PID"
+done
+
+"$SLIMM" reduce -o "$WORK/reduced/sample" "$DB" "$WORK/parts"
+"$SLIMM" -o "$WORK/whole/sample" "$DB" "$BAM"
+
+STATUS=0
+COMPARED=0
+for REPORT in "$WORK"/whole/*.tsv; do
+    [ -e "$REPORT" ] || continue
+    NAME=$(basename "$REPORT")
+    COMPARED=$((COMPARED + 1))
+    if ! diff -q "$REPORT" "$WORK/reduced/$NAME" > /dev/null 2>&1; then
+        echo "[FAILED] $NAME differs between slimm and slimm map/reduce" >&2
+        diff "$REPORT" "$WORK/reduced/$NAME" 2>&1 | head -20 >&2
+        STATUS=1
+    fi
+done
+for REPORT in "$WORK"/reduced/*.tsv; do
+    [ -e "$REPORT" ] || continue
+    if [ ! -e "$WORK/whole/$(basename "$REPORT")" ]; then
+        echo "[FAILED] only slimm reduce wrote $(basename "$REPORT")" >&2
+        STATUS=1
+    fi
+done
+if [ "$COMPARED" -eq 0 ]; then
+    echo "[FAILED] slimm wrote no reports" >&2
+    exit 1
+fi
+[ "$STATUS" -eq 0 ] && echo "[PASSED] $COMPARED reports of $PARTS shards are the same as those of the whole file"
+exit $STATUS
@@ -0,0 +1,181 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+// ==========================================================================
+
+// Stress test of read_table: many threads add the same hits that a single
+// std::unordered_map gets one after the other. The reads and their targets
+// have to be the same. Filled shard by shard in record order (as
+// analyze_alignments() does) the first bin of every target has to match too.
+
+#include <seqan/basic.h>
+#include <seqan/parallel.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "misc.hpp"
+#include "reference_contig.hpp"
+#include "read_stat.hpp"
+
+using namespace seqan;
+
+typedef std::unordered_map<std::string, read_stat>  TReadMap;
+
+struct test_hit
+{
+    std::string read_key;
+    uint32_t    ref_id;
+    uint32_t    bin_number;
+};
+
+// reads with a few hits each, some on the same reference, in shuffled order
+std::vector<test_hit> make_hits(uint32_t reads_count, uint32_t refs_count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<test_hit> hits;
+    for (uint32_t r = 0; r < reads_count; ++r)
+    {
+        std::string read_key = "read_" + std::to_string(r) + (r % 3 ? ".1" : ".2");
+        uint32_t hits_count = 1 + rng() % 6;
+        for (uint32_t h = 0; h < hits_count; ++h)
+            hits.push_back({read_key, uint32_t(rng() % refs_count), uint32_t(rng() % 1000)});
+    }
+    std::shuffle(hits.begin(), hits.end(), rng);
+    return hits;
+}
+
+// the sorted reference ids of a read, with their first bins if with_bins
+std::vector<std::pair<uint32_t, uint32_t> > target_list(read_stat const & read, bool with_bins)
+{
+    std::vector<std::pair<uint32_t, uint32_t> > targets;
+    for (auto const & tr : read.targets)
+        targets.push_back(std::make_pair(tr.reference_id, with_bins ? tr.positions[0] : 0u));
+    std::sort(targets.begin(), targets.end());
+    return targets;
+}
+
+// the reads of the table have to be those of the map
+bool same_reads(read_table & table, TReadMap const & expected, bool with_bins, char const * test_name)
+{
+    if (table.size() != expected.size())
+    {
+        std::cerr << "[FAILED] " << test_name << ": " << table.size() << " reads instead of "
+                  << expected.size() << "\n";
+        return false;
+    }
+    for (uint32_t s = 0; s < table.shards_count(); ++s)
+    {
+        for (auto const & read : table.shard(s))
+        {
+            auto found = expected.find(read.first);
+            if (found == expected.end() ||
+                target_list(read.second, with_bins) != target_list(found->second, with_bins))
+            {
+                std::cerr << "[FAILED] " << test_name << ": the targets of " << read.first << " differ\n";
+                return false;
+            }
+            if (s != table.shard_index(read.first))
+            {
+                std::cerr << "[FAILED] " << test_name << ": " << read.first << " is in the wrong shard\n";
+                return false;
+            }
+        }
+    }
+    std::cerr << "[PASSED] " << test_name << "\n";
+    return true;
+}
+
+// concurrent add_target() calls from many threads
+bool test_locked_adds(std::vector<test_hit> const & hits, TReadMap const & expected, int threads_count)
+{
+    read_table table;
+    int64_t hits_count = hits.size();
+    SEQAN_OMP_PRAGMA(parallel for schedule(dynamic, 64) num_threads(threads_count))
+    for (int64_t i = 0; i < hits_count; ++i)
+        table.add_target(hits[i].read_key, hits[i].ref_id, hits[i].bin_number);
+    // the first bins depend on which thread came first
+    return same_reads(table, expected, false, "concurrent add_target()");
+}
+
+// every shard filled by one task in record order
+bool test_shard_fills(std::vector<test_hit> const & hits, TReadMap const & expected, int threads_count)
+{
+    read_table table;
+    std::vector<std::vector<uint32_t> > shard_hits(table.shards_count());
+    for (uint32_t i = 0; i < hits.size(); ++i)
+        shard_hits[table.shard_index(hits[i].read_key)].push_back(i);
+    int64_t shards_count = table.shards_count();
+    SEQAN_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(threads_count))
+    for (int64_t s = 0; s < shards_count; ++s)
+        for (auto i : shard_hits[s])
+            table.shard(s)[hits[i].read_key].add_target(hits[i].ref_id, hits[i].bin_number);
+    return same_reads(table, expected, true, "shard fills in record order");
+}
+
+bool test_clear(std::vector<test_hit> const & hits)
+{
+    read_table table(16);
+    for (auto const & hit : hits)
+        table.add_target(hit.read_key, hit.ref_id, hit.bin_number);
+    table.clear();
+    bool passed = table.shards_count() == 16 && table.size() == 0;
+    std::cerr << (passed ? "[PASSED]" : "[FAILED]") << " clear()\n";
+    return passed;
+}
+
+int main(int argc, char const ** argv)
+{
+    uint32_t reads_count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    // more threads than cores make the adds interleave
+    int threads_count = std::max(8, int(get_max_threads() * 2));
+
+    std::vector<test_hit> hits = make_hits(reads_count, 64, 42);
+    TReadMap expected;
+    for (auto const & hit : hits)
+        expected[hit.read_key].add_target(hit.ref_id, hit.bin_number);
+
+    bool passed = true;
+    for (uint32_t round = 0; round < 4; ++round)
+    {
+        passed &= test_locked_adds(hits, expected, threads_count);
+        passed &= test_shard_fills(hits, expected, threads_count);
+    }
+    passed &= test_clear(hits);
+    return passed ? 0 : 1;
+}